@@ -68,6 +68,22 @@ void uhda_kernel_free(void* ptr, size_t size);
  */
 void uhda_kernel_delay(uint32_t microseconds);
 
+/*
+ * Optional: sleeps for at least the specified number of microseconds, giving the cpu to other work.
+ *
+ * Only used if uHDA is compiled with `UHDA_KERNEL_HAS_SLEEP` defined, `uhda_kernel_delay` is used otherwise.
+ * Note: never called from an irq handler or while a spinlock is held.
+ */
+void uhda_kernel_sleep(uint32_t microseconds);
+
+/*
+ * Optional: gets the value of a monotonic clock in nanoseconds.
+ *
+ * Only used if uHDA is compiled with `UHDA_KERNEL_HAS_CLOCK` defined,
+ * timeouts are then measured in real time instead of by counting the time spent waiting.
+ */
+uint64_t uhda_kernel_get_nanoseconds(void);
+
 /*
  * Logs a message.
  */
@@ -77,6 +93,8 @@ void uhda_kernel_log(const char* str);
  * Allocates `size` bytes of aligned contiguous physical memory.
  *
  * Note: align is always 0x1000.
+ * Note: streams set up with `contiguous` allocate their whole buffer using this, the simple stream api
+ * asks for a megabyte and falls back to scatter chunks if this returns `UHDA_STATUS_NO_MEMORY`.
  */
 UhdaStatus uhda_kernel_allocate_physical(size_t size, uintptr_t* res);
 
@@ -91,7 +109,7 @@ void uhda_kernel_deallocate_physical(uintptr_t phys, size_t size);
  * Note: Returned chunks must be 128-byte aligned.
  * Note: Mapping the chunks to virtual memory is optional unless using the simple stream API,
  * if not mapping them then it is advised to set the `virt` field of the chunks to null.
- * Note: `size` depends on stream period size, when using the simple api it's at most 0x1000 bytes.
+ * Note: `size` is the stream period size or its chunk size if set, when using the simple api it's at most 0x1000 bytes.
  */
 UhdaStatus uhda_kernel_allocate_scatter(size_t count, size_t size, UhdaScatterChunk* res);
 
@@ -110,6 +128,24 @@ UhdaStatus uhda_kernel_map(uintptr_t phys, size_t size, void** virt);
  */
 void uhda_kernel_unmap(void* virt, size_t size);
 
+/*
+ * Optional: maps `size` bytes starting at physical address `phys` in virtual memory using the given memory type.
+ *
+ * Only used if uHDA is compiled with `UHDA_KERNEL_HAS_MAP_TYPE` defined, it's used for the contiguous stream
+ * buffers which uHDA maps itself. The mapping is unmapped using `uhda_kernel_unmap`.
+ */
+UhdaStatus uhda_kernel_map_type(uintptr_t phys, size_t size, UhdaMapType type, void** virt);
+
+/*
+ * Optional: writes back the cpu caches for `size` bytes of memory mapped as `UHDA_MAP_TYPE_CACHEABLE`
+ * so that the controller sees the data.
+ *
+ * Only used if uHDA is compiled with `UHDA_KERNEL_HAS_MAP_TYPE` defined.
+ * Note: uHDA enables snooping on the controllers it knows how to, so this may be empty on cache coherent platforms.
+ * Note: may be called from the period callback.
+ */
+void uhda_kernel_flush_cache(void* virt, size_t size);
+
 /*
  * Creates an opaque spinlock.
  */
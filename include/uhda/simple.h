@@ -13,6 +13,53 @@ extern "C" {
 
 typedef struct UhdaSimpleStream UhdaSimpleStream;
 
+/*
+ * Called from the period callback once the data queued to a stream drops to its low watermark,
+ * `remaining` is the amount of data still queued.
+ */
+typedef void (*UhdaSimpleWatermarkFn)(UhdaSimpleStream* stream, uint32_t remaining, void* arg);
+
+/*
+ * Called from the period callback to render up to `size` bytes of data into `data`, returns the amount written.
+ * Returning less than `size` means that no more data is available right now, the rest is filled with silence.
+ *
+ * Note: the stream is locked while this is called, so it must not call any functions on the stream.
+ */
+typedef uint32_t (*UhdaSimplePullFn)(UhdaSimpleStream* stream, void* data, uint32_t size, void* arg);
+
+typedef struct UhdaSimpleBuffer UhdaSimpleBuffer;
+
+/*
+ * Called once a buffer queued using `uhda_simple_stream_queue_buffer` has been played, `played` is false
+ * if it was removed from the queue before being played completely. The buffer can be reused once this is called.
+ */
+typedef void (*UhdaSimpleBufferFn)(UhdaSimpleBuffer* buffer, bool played, void* arg);
+
+/*
+ * A client-owned buffer that is copied straight into the dma buffer while it's being played.
+ * Both the buffer and its data must stay valid until `fn` is called.
+ */
+struct UhdaSimpleBuffer {
+	const void* data;
+	uint32_t size;
+	UhdaSimpleBufferFn fn;
+	void* arg;
+
+	// used internally while the buffer is queued
+	UhdaSimpleBuffer* next;
+	uint32_t offset;
+	uint32_t ring_before;
+	uint64_t end;
+};
+
+/*
+ * A part of the data queued using `uhda_simple_stream_queue_segments`.
+ */
+typedef struct UhdaSimpleSegment {
+	const void* data;
+	uint32_t size;
+} UhdaSimpleSegment;
+
 /*
  * Stream parameters
  *
@@ -28,6 +75,29 @@ typedef struct UhdaSimpleStreamParams {
 } UhdaSimpleStreamParams;
 
 UhdaStatus uhda_simple_stream_new(UhdaStream* base, UhdaSimpleStream** res);
+
+/*
+ * Allocates a simple stream that is already set up with `params` on a free hardware output stream.
+ *
+ * If all hardware output streams are in use, the stream becomes a virtual stream that is mixed in software
+ * into another stream allocated using this function with exactly the same sample rate, channels and format.
+ * Only 16-bit and wider formats can be mixed.
+ *
+ * Returns `UHDA_STATUS_UNSUPPORTED` if all hardware output streams are in use and none of them
+ * can be mixed into because of a different format.
+ * Note: a virtual stream shares the outputs of the stream it is mixed into,
+ * so a path set up for any of them plays the mix of all of them.
+ */
+UhdaStatus uhda_simple_stream_alloc(
+	UhdaController* controller,
+	const UhdaSimpleStreamParams* params,
+	UhdaSimpleStream** res);
+
+/*
+ * Destroys a simple stream, streams from `uhda_simple_stream_alloc` also release
+ * their hardware stream once no other stream is mixed into it.
+ * Buffers that are still queued are returned unplayed.
+ */
 void uhda_simple_stream_destroy(UhdaSimpleStream* stream);
 
 /*
@@ -37,6 +107,8 @@ UhdaStatus uhda_simple_path_setup(UhdaPath* path, UhdaSimpleStream* stream);
 
 /*
  * Sets up a stream for playback.
+ *
+ * Note: streams sharing their hardware stream with others can't be set up again.
  */
 UhdaStatus uhda_simple_stream_setup(
 	UhdaSimpleStream* stream,
@@ -55,7 +127,78 @@ UhdaStatus uhda_simple_stream_play(UhdaSimpleStream* stream, bool play);
 UhdaStatus uhda_simple_stream_queue_data(UhdaSimpleStream* stream, const void* data, uint32_t* size);
 
 /*
- * Clears all currently queued data from the stream.
+ * Queues the data of `count` segments in order like a single `uhda_simple_stream_queue_data` call
+ * and returns the total amount of data written in `size`.
+ * If the ring buffer space is exhausted, the segments after it are not written.
+ */
+UhdaStatus uhda_simple_stream_queue_segments(
+	UhdaSimpleStream* stream,
+	const UhdaSimpleSegment* segments,
+	size_t count,
+	uint32_t* size);
+
+/*
+ * Queues `frames` frames from separate buffers for each channel, interleaving them while copying,
+ * and returns the actual amount of frames written in `frames`.
+ * `planes` contains one buffer per channel of the stream with samples of the stream's format,
+ * 20 and 24-bit samples are in 32-bit containers like in interleaved data.
+ *
+ * Note: only whole frames are written.
+ */
+UhdaStatus uhda_simple_stream_queue_planar(
+	UhdaSimpleStream* stream,
+	const void* const* planes,
+	uint32_t* frames);
+
+/*
+ * Queues a client-owned buffer to the stream without copying it, the buffers and the data queued
+ * using the other queue functions are played in the order they were queued.
+ *
+ * Returns `UHDA_STATUS_UNSUPPORTED` if the buffer is empty.
+ * Note: `fn` is called from the period callback without the stream locked once the controller has read
+ * the whole buffer, or from `uhda_simple_stream_clear_queue` and `uhda_simple_stream_destroy`.
+ */
+UhdaStatus uhda_simple_stream_queue_buffer(UhdaSimpleStream* stream, UhdaSimpleBuffer* buffer);
+
+/*
+ * Sets a callback that is called once the data queued to the stream drops to `low` bytes,
+ * it's called again only after the queue has been filled up to at least `high` bytes.
+ * A null `fn` disables the notifications.
+ *
+ * Returns `UHDA_STATUS_UNSUPPORTED` if `low` is larger than `high`.
+ * Note: the callback is called from the period callback without the stream locked, so it can queue more data.
+ * Note: a stream must not be destroyed while its callback may be running.
+ */
+UhdaStatus uhda_simple_stream_set_watermarks(
+	UhdaSimpleStream* stream,
+	uint32_t low,
+	uint32_t high,
+	UhdaSimpleWatermarkFn fn,
+	void* arg);
+
+/*
+ * Puts the stream into pull mode, every period callback asks `fn` for exactly the amount of data
+ * missing from the ring buffer to fill the consumed periods so it can be rendered just in time.
+ * Data can still be queued in pull mode and is played before the pulled data, a null `fn` disables pull mode.
+ * Nothing is pulled while buffers are queued.
+ *
+ * Note: the ring buffer must be large enough for the first fill when starting the stream, which is 0x4000 bytes.
+ * Note: a stream paused by the idle pause is only restarted by `uhda_simple_stream_play` or by queuing data.
+ */
+void uhda_simple_stream_set_pull(UhdaSimpleStream* stream, UhdaSimplePullFn fn, void* arg);
+
+/*
+ * Pauses the hardware stream after `silent_periods` periods of silence were played while the stream is playing
+ * and restarts it as soon as data is queued again, 0 disables the idle pause (the default).
+ *
+ * Note: the setting belongs to the hardware stream, so it's shared by all streams mixed into it.
+ * Note: the base stream reports itself as paused while idle.
+ */
+void uhda_simple_stream_set_idle_pause(UhdaSimpleStream* stream, uint32_t silent_periods);
+
+/*
+ * Clears all currently queued data from the stream, queued buffers that weren't copied completely
+ * into the dma buffer are returned unplayed.
  */
 UhdaStatus uhda_simple_stream_clear_queue(UhdaSimpleStream* stream);
 
@@ -27,9 +27,36 @@ typedef enum UhdaIrqHint {
 
 typedef uintptr_t UhdaIrqState;
 
+typedef enum UhdaVerbTransport {
+	// the CORB/RIRB ring buffers, which can queue many verbs at once
+	UHDA_VERB_TRANSPORT_RINGS,
+	// the immediate command registers, which send one verb at a time without DMA
+	UHDA_VERB_TRANSPORT_IMMEDIATE
+} UhdaVerbTransport;
+
+typedef enum UhdaMapType {
+	UHDA_MAP_TYPE_UNCACHEABLE,
+	// uncached but writes are combined into bursts, reads are still slow
+	UHDA_MAP_TYPE_WRITE_COMBINING,
+	// cached, the controller has to snoop the caches or the caches have to be flushed
+	UHDA_MAP_TYPE_CACHEABLE
+} UhdaMapType;
+
 typedef bool (*UhdaIrqHandlerFn)(void* arg);
 
 typedef struct UhdaController UhdaController;
+
+typedef enum UhdaInitStage {
+	// the controller is out of reset and the codecs are given time to wake up
+	UHDA_INIT_STAGE_LINK_UP,
+	// a codec was enumerated
+	UHDA_INIT_STAGE_CODEC,
+	// the initialization is finished, the status is its result
+	UHDA_INIT_STAGE_DONE
+} UhdaInitStage;
+
+typedef void (*UhdaInitFn)(UhdaController* controller, UhdaInitStage stage, UhdaStatus status, void* arg);
+
 typedef struct UhdaCodec UhdaCodec;
 
 typedef struct UhdaPath UhdaPath;
@@ -81,6 +108,18 @@ typedef enum UhdaLocation {
 	UHDA_LOCATION_UNKNOWN
 } UhdaLocation;
 
+/*
+ * Codec verb counters
+ *
+ * `verbs_sent` is the amount of control verbs sent to the codec.
+ * `verbs_skipped` is the amount of control verbs that were dropped because
+ * they wouldn't have changed the state of the widget.
+ */
+typedef struct UhdaCodecStats {
+	uint64_t verbs_sent;
+	uint64_t verbs_skipped;
+} UhdaCodecStats;
+
 typedef struct UhdaOutputInfo {
 	UhdaOutputType type;
 	UhdaColor color;
@@ -88,6 +127,7 @@ typedef struct UhdaOutputInfo {
 } UhdaOutputInfo;
 
 typedef void (*UhdaPeriodFn)(UhdaStream* stream, void* arg);
+typedef void (*UhdaPresenceFn)(const UhdaOutput* output, bool presence, void* arg);
 
 typedef enum UhdaFormat {
 	UHDA_FORMAT_PCM8,
@@ -104,6 +144,31 @@ typedef struct UhdaPathInfo {
 	uint32_t supported_formats_count;
 } UhdaPathInfo;
 
+#define UHDA_RATE_8000 (1U << 0)
+#define UHDA_RATE_11025 (1U << 1)
+#define UHDA_RATE_16000 (1U << 2)
+#define UHDA_RATE_22050 (1U << 3)
+#define UHDA_RATE_32000 (1U << 4)
+#define UHDA_RATE_44100 (1U << 5)
+#define UHDA_RATE_48000 (1U << 6)
+#define UHDA_RATE_88200 (1U << 7)
+#define UHDA_RATE_96000 (1U << 8)
+#define UHDA_RATE_176400 (1U << 9)
+#define UHDA_RATE_192000 (1U << 10)
+
+#define UHDA_FORMAT_BIT(fmt) (1U << (fmt))
+
+/*
+ * Path capabilities as bitmasks
+ *
+ * `rates` is a combination of `UHDA_RATE_*` bits.
+ * `formats` is a combination of `UHDA_FORMAT_BIT(fmt)` bits.
+ */
+typedef struct UhdaPathCaps {
+	uint32_t rates;
+	uint32_t formats;
+} UhdaPathCaps;
+
 /*
  * Stream parameters
  *
@@ -111,12 +176,21 @@ typedef struct UhdaPathInfo {
  * `period_size` is the size of one period.
  * `period_callback_distance` is the amount of periods between calls to the period callback.
  * `period_callback` is a callback called when a period worth of data is consumed/produced.
+ * `contiguous` allocates the whole buffer as one physically and virtually contiguous block
+ * which the periods are placed in back to back, see `uhda_stream_get_buffer`.
+ * `chunk_size` if non-zero and smaller than `period_size` splits every period into chunks of at most
+ * this many bytes so large periods don't need large contiguous allocations, see `uhda_stream_get_chunks`.
+ * It's ignored for contiguous buffers.
  *
  * Total buffer size is equal to `period_count * period_size`.
  *
  * Note: the period callback is run in an interrupt context and is mandatory.
  * Note: it is advised for `period_count` to be evenly divisible by `period_callback_distance`,
  * if not then the time between the last and first callbacks of the buffer is different from the rest.
+ * Note: with `contiguous` the period size must be a multiple of `UHDA_CONTIGUOUS_PERIOD_SIZE_ALIGNMENT`
+ * as every period has to start at an address suitable for the controller.
+ * Note: `chunk_size` must be a multiple of `UHDA_CHUNK_SIZE_ALIGNMENT` and there can be at most
+ * `UHDA_MAX_CHUNKS` chunks in total, the period callback is only called after the last chunk of a period.
  */
 
 typedef struct UhdaStreamParams {
@@ -128,6 +202,8 @@ typedef struct UhdaStreamParams {
 	uint32_t period_callback_distance;
 	UhdaPeriodFn period_callback;
 	void* period_callback_arg;
+	bool contiguous;
+	uint32_t chunk_size;
 } UhdaStreamParams;
 
 #define UHDA_MIN_PERIODS 2
@@ -135,6 +211,10 @@ typedef struct UhdaStreamParams {
 
 #define UHDA_MIN_PERIOD_SIZE 2
 #define UHDA_PERIOD_SIZE_ALIGNMENT 2
+#define UHDA_CONTIGUOUS_PERIOD_SIZE_ALIGNMENT 128
+
+#define UHDA_CHUNK_SIZE_ALIGNMENT 128
+#define UHDA_MAX_CHUNKS 256
 #define UHDA_MAX_PERIOD_SIZE 0xFFFFFFFF
 
 #define UHDA_MIN_PERIOD_CALLBACK_DISTANCE 1
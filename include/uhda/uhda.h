@@ -71,6 +71,25 @@ bool uhda_class_matches(uint16_t clazz, uint16_t subclass);
  */
 UhdaStatus uhda_init(void* pci_device, UhdaController** res);
 
+/*
+ * Starts initializing HDA for the PCI device without waiting for the controller or the codecs.
+ *
+ * The initialization is advanced by calling `uhda_init_poll` (e.g. from a timer or a work queue)
+ * and `fn` is called with the progress and the final status from within `uhda_init_poll`.
+ * Note: the controller must not be used for anything else until `fn` is called with `UHDA_INIT_STAGE_DONE`,
+ * if the final status is not success the controller must be destroyed using `uhda_destroy`.
+ */
+UhdaStatus uhda_init_async(void* pci_device, UhdaInitFn fn, void* arg, UhdaController** res);
+
+/*
+ * Advances an initialization started by `uhda_init_async` until it has to wait.
+ *
+ * Returns true if it isn't finished yet, in which case it should be called again
+ * after `*delay_us` microseconds (0 means that it can be called again right away).
+ * Every codec is enumerated in a separate call.
+ */
+bool uhda_init_poll(UhdaController* controller, uint32_t* delay_us);
+
 /*
  * Destroys a previously initialized HDA controller instance.
  *
@@ -94,6 +113,8 @@ UhdaStatus uhda_suspend(UhdaController* controller);
  *
  * Note: uHDA expects the kernel to restore the PCI BARs before calling this function.
  * Note: it is safe to call this function multiple times in case it fails.
+ * Note: the codecs are enumerated again, so codecs, output groups, outputs and paths
+ * obtained before the suspend must not be used anymore.
  */
 UhdaStatus uhda_resume(UhdaController* controller);
 
@@ -102,6 +123,42 @@ UhdaStatus uhda_resume(UhdaController* controller);
  */
 void uhda_get_codecs(UhdaController* controller, const UhdaCodec* const** codecs, size_t* codec_count);
 
+/*
+ * Selects how verbs are sent to the codecs, the default is `UHDA_VERB_TRANSPORT_RINGS`.
+ *
+ * The immediate command interface doesn't need the ring buffer DMA to work,
+ * so it can be used on controllers where that is broken.
+ * It may be called right after `uhda_init_async` to enumerate the codecs using the selected transport
+ * and the selection is kept across suspend/resume.
+ * Note: unsolicited responses (and so presence callbacks) are only received with the rings.
+ * Note: must not be called while verbs are being sent from other threads.
+ */
+UhdaStatus uhda_set_verb_transport(UhdaController* controller, UhdaVerbTransport transport);
+
+/*
+ * Selects how contiguous stream buffers are mapped and programs the controller's snooping to match,
+ * the default is `UHDA_MAP_TYPE_WRITE_COMBINING` if the kernel provides `uhda_kernel_map_type`.
+ *
+ * Returns `UHDA_STATUS_UNSUPPORTED` for anything other than `UHDA_MAP_TYPE_UNCACHEABLE`
+ * if uHDA is compiled without `UHDA_KERNEL_HAS_MAP_TYPE`.
+ * Note: only affects streams set up afterwards, scatter chunks are always mapped by the kernel.
+ */
+UhdaStatus uhda_set_buffer_map_type(UhdaController* controller, UhdaMapType type);
+
+/*
+ * Allocates an unused hardware stream of the controller, `output` selects between output and input streams.
+ *
+ * Returns `UHDA_STATUS_NO_MEMORY` if all streams of that direction are already allocated.
+ * Note: the streams returned by `uhda_get_output_streams` are not tracked,
+ * so they shouldn't be used directly together with this function.
+ */
+UhdaStatus uhda_stream_alloc(UhdaController* controller, bool output, UhdaStream** res);
+
+/*
+ * Returns a stream allocated using `uhda_stream_alloc`, it must be shut down first.
+ */
+void uhda_stream_free(UhdaStream* stream);
+
 /*
  * Gets a list of HDA output streams.
  */
@@ -115,6 +172,29 @@ void uhda_codec_get_output_groups(
 	const UhdaOutputGroup* const** output_groups,
 	size_t* output_group_count);
 
+/*
+ * Gets the vendor and revision ids of a codec.
+ */
+void uhda_codec_get_ids(const UhdaCodec* codec, uint32_t* vendor_id, uint32_t* revision_id);
+
+/*
+ * Gets the control verb counters of a codec.
+ */
+UhdaCodecStats uhda_codec_get_stats(const UhdaCodec* codec);
+
+/*
+ * Gets a codec parameter of a node.
+ *
+ * Note: parameters are read-only, so they are served from a cache once they have been read
+ * (the cache is kept across suspend/resume as long as the same codec is present).
+ */
+UhdaStatus uhda_codec_get_parameter(const UhdaCodec* codec, uint8_t nid, uint8_t param, uint32_t* res);
+
+/*
+ * Gets the configuration default of a pin node, it is cached like the parameters.
+ */
+UhdaStatus uhda_codec_get_config_default(const UhdaCodec* codec, uint8_t nid, uint32_t* res);
+
 /*
  * Gets a list of outputs from an output group.
  */
@@ -125,9 +205,48 @@ void uhda_output_group_get_outputs(
 
 /*
  * Gets presence info of an output if available.
+ *
+ * Note: outputs capable of presence detection report plug events using unsolicited responses,
+ * so after the first query the presence is served from memory while the rings are used.
  */
 UhdaStatus uhda_output_get_presence(const UhdaOutput* output, bool* presence);
 
+/*
+ * Gets presence info of multiple outputs of the same controller at once, the pin sense verbs
+ * of all the outputs are submitted together instead of one at a time.
+ *
+ * Note: outputs that don't support presence detection are reported as not present.
+ */
+UhdaStatus uhda_outputs_get_presence(const UhdaOutput* const* outputs, size_t count, bool* presence);
+
+/*
+ * Gets presence info of all outputs of a codec at once like `uhda_outputs_get_presence`.
+ *
+ * The outputs are in the order returned by `uhda_codec_get_output_groups` and `uhda_output_group_get_outputs`.
+ * `count` is the size of the `presence` array on input and the count of outputs on output,
+ * `UHDA_STATUS_NO_MEMORY` is returned if the array is too small.
+ */
+UhdaStatus uhda_codec_get_presence(const UhdaCodec* codec, bool* presence, size_t* count);
+
+/*
+ * Reads the presence of the outputs that reported a plug event since their presence was last read
+ * and calls their presence callbacks if it changed. Does nothing if there were no plug events.
+ *
+ * The irq handler only records plug events as it can't send verbs, so this is meant to be called from
+ * a deferred context after the irq handler has run (or periodically).
+ * Note: must not be called during `uhda_suspend` or `uhda_resume`.
+ */
+UhdaStatus uhda_poll_presence(UhdaController* controller);
+
+/*
+ * Sets a callback called when something is plugged into or unplugged from an output,
+ * passing a null callback removes it.
+ *
+ * Note: the callback is called when the changed presence is read, which happens in `uhda_poll_presence`
+ * or in any of the functions getting the presence.
+ */
+UhdaStatus uhda_output_set_presence_callback(const UhdaOutput* output, UhdaPresenceFn fn, void* arg);
+
 /*
  * Gets info about an output.
  */
@@ -163,14 +282,50 @@ UhdaStatus uhda_find_path(
 
 /*
  * Gets info about a path.
+ *
+ * The rates and formats are the ones supported by every widget in the path.
  */
 UhdaPathInfo uhda_path_get_info(const UhdaPath* path);
 
+/*
+ * Gets the rates and formats supported by every widget in the path as bitmasks.
+ */
+UhdaPathCaps uhda_path_get_caps(const UhdaPath* path);
+
+/*
+ * Gets the `UHDA_RATE_*` bit corresponding to a sample rate or 0 if the rate is not a standard one.
+ */
+uint32_t uhda_rate_bit(uint32_t sample_rate);
+
 /*
  * Sets up a path for playback.
  */
 UhdaStatus uhda_path_setup(UhdaPath* path, UhdaStreamParams* params, UhdaStream* stream);
 
+/*
+ * Finds paths to all outputs of an output group that each use a different converter,
+ * so that the whole group can play one multichannel stream using `uhda_paths_setup_multichannel`.
+ *
+ * `paths` must have space for as many paths as the group has outputs,
+ * they are returned in the same order as the outputs (which are sorted by their sequence).
+ * A headphone output sharing the group (sequence 0xF) doesn't get a path.
+ */
+UhdaStatus uhda_output_group_find_paths(const UhdaOutputGroup* group, UhdaPath** paths, size_t* path_count);
+
+/*
+ * Sets up paths for playing different channels of one multichannel stream,
+ * path `i` gets the channels `2 * i` and `2 * i + 1` of the stream.
+ *
+ * The stream must have enough channels for every path to get at least one.
+ * Note: for the usual output group with front, center/lfe, rear and side outputs
+ * the channel order is FL, FR, C, LFE, RL, RR, SL, SR.
+ */
+UhdaStatus uhda_paths_setup_multichannel(
+	UhdaPath** paths,
+	size_t path_count,
+	UhdaStreamParams* params,
+	UhdaStream* stream);
+
 /*
  * Shuts down an already set up path.
  */
@@ -228,11 +383,41 @@ uint32_t uhda_stream_get_position(const UhdaStream* stream);
 
 /*
  * Gets the scatter chunks for the periods.
+ * Returns `UHDA_STATUS_UNSUPPORTED` if the periods are split into multiple chunks.
  *
  * Note: The returned pointer and chunks are valid until the stream is shut down.
  */
 UhdaStatus uhda_stream_get_periods(UhdaStream* stream, const UhdaScatterChunk** chunks);
 
+/*
+ * Gets all scatter chunks of a stream in playback order.
+ * Every period starts in a new chunk and all chunks hold `chunk_size` bytes
+ * except the last chunk of a period which only holds the rest of the period.
+ *
+ * Note: The returned pointer and chunks are valid until the stream is shut down.
+ */
+UhdaStatus uhda_stream_get_chunks(
+	UhdaStream* stream,
+	const UhdaScatterChunk** chunks,
+	uint32_t* chunk_count,
+	uint32_t* chunk_size);
+
+/*
+ * Makes `size` bytes written by the cpu at `offset` in the stream buffer visible to the controller,
+ * needed after writing to the periods or the buffer of a stream mapped as `UHDA_MAP_TYPE_CACHEABLE`.
+ *
+ * Note: may be called from the period callback.
+ */
+void uhda_stream_flush(UhdaStream* stream, uint32_t offset, uint32_t size);
+
+/*
+ * Gets the whole buffer of a stream set up with `contiguous`, the periods are placed in it back to back.
+ * Returns `UHDA_STATUS_UNSUPPORTED` if the stream isn't set up or its buffer is scattered.
+ *
+ * Note: The returned buffer is valid until the stream is shut down.
+ */
+UhdaStatus uhda_stream_get_buffer(UhdaStream* stream, UhdaScatterChunk* buffer, uint32_t* size);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,161 @@
+#pragma once
+#include "uhda/kernel_api.h"
+#include "utils.hpp"
+
+namespace uhda {
+	/*
+	 * A bump allocator whose memory is only released all at once when it is destroyed.
+	 */
+	class Arena {
+	public:
+		constexpr Arena() = default;
+
+		Arena(const Arena&) = delete;
+		Arena& operator=(const Arena&) = delete;
+
+		Arena(Arena&& other) noexcept : head {other.head} {
+			other.head = nullptr;
+		}
+
+		Arena& operator=(Arena&& other) noexcept {
+			if (this != &other) {
+				release();
+				head = other.head;
+				other.head = nullptr;
+			}
+			return *this;
+		}
+
+		~Arena() {
+			release();
+		}
+
+		/*
+		 * Makes sure that at least `size` bytes can be allocated without allocating a new block,
+		 * including the padding needed to align them to `MAX_ALIGN`.
+		 */
+		[[nodiscard]] bool reserve(size_t size) {
+			if (head && fits(size, MAX_ALIGN)) {
+				return true;
+			}
+			return new_block(size + MAX_ALIGN);
+		}
+
+		[[nodiscard]] void* alloc(size_t size, size_t align) {
+			if (!head || !fits(size, align)) {
+				if (!new_block(size + align)) {
+					return nullptr;
+				}
+			}
+
+			size_t offset = aligned_offset(align);
+			head->used = offset + size;
+			return block_data(head) + offset;
+		}
+
+		/*
+		 * Grows the most recent allocation in place if there is space for it in the current block.
+		 */
+		[[nodiscard]] bool extend(void* ptr, size_t old_size, size_t new_size) {
+			if (!head || static_cast<char*>(ptr) + old_size != block_data(head) + head->used) {
+				return false;
+			}
+
+			size_t start = static_cast<char*>(ptr) - block_data(head);
+			if (start + new_size > head->size) {
+				return false;
+			}
+
+			head->used = start + new_size;
+			return true;
+		}
+
+		template<typename T, typename... Args>
+		T* create(Args&&... args) {
+			auto* ptr = alloc(sizeof(T), alignof(T));
+			if (!ptr) {
+				return nullptr;
+			}
+			return construct<T>(ptr, forward<Args>(args)...);
+		}
+
+		void release() {
+			while (head) {
+				auto* next = head->next;
+				uhda_kernel_free(head, sizeof(Block) + head->size);
+				head = next;
+			}
+		}
+
+		// the largest alignment that `reserve` accounts for
+		static constexpr size_t MAX_ALIGN = 16;
+
+	private:
+		static constexpr size_t MIN_BLOCK_SIZE = 0x1000 - 32;
+
+		struct Block {
+			Block* next;
+			size_t size;
+			size_t used;
+		};
+
+		static constexpr size_t align_up(size_t value, size_t align) {
+			return (value + align - 1) & ~(align - 1);
+		}
+
+		static char* block_data(Block* block) {
+			return reinterpret_cast<char*>(block + 1);
+		}
+
+		// the offset of the next allocation in the current block, the address is aligned and not the offset
+		// as the block data only has the alignment of the block header
+		size_t aligned_offset(size_t align) const {
+			auto data = reinterpret_cast<uintptr_t>(block_data(head));
+			return align_up(data + head->used, align) - data;
+		}
+
+		bool fits(size_t size, size_t align) const {
+			return aligned_offset(align) + size <= head->size;
+		}
+
+		bool new_block(size_t min_size) {
+			size_t size = head ? head->size * 2 : MIN_BLOCK_SIZE;
+			if (size < min_size) {
+				size = min_size;
+			}
+
+			auto* block = static_cast<Block*>(uhda_kernel_malloc(sizeof(Block) + size));
+			if (!block) {
+				return false;
+			}
+
+			block->next = head;
+			block->size = size;
+			block->used = 0;
+			head = block;
+			return true;
+		}
+
+		Block* head {};
+	};
+
+	/*
+	 * Allocator for containers whose storage lives in an arena,
+	 * such containers don't free anything or destroy their elements on destruction.
+	 */
+	struct ArenaAllocator {
+		static constexpr bool RELEASES_IN_BULK = true;
+
+		void* allocate(size_t size, size_t align) {
+			return arena->alloc(size, align);
+		}
+
+		void deallocate(void*, size_t) {}
+
+		bool extend(void* ptr, size_t old_size, size_t new_size) {
+			return arena->extend(ptr, old_size, new_size);
+		}
+
+		Arena* arena;
+	};
+}
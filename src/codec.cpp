@@ -5,9 +5,63 @@
 
 using namespace uhda;
 
+// the parameters cached for each widget during enumeration, including the configuration default
+static constexpr size_t CACHED_WIDGET_PARAMS = 7;
+// the parameters of the root node and the function groups
+static constexpr size_t CACHED_GROUP_PARAMS = 16;
+
+UhdaCodec* UhdaCodec::create(UhdaController* controller, uint8_t cid) {
+	Arena arena;
+	auto* ptr = arena.alloc(sizeof(UhdaCodec), alignof(UhdaCodec));
+	if (!ptr) {
+		return nullptr;
+	}
+
+	void* lock;
+	if (uhda_kernel_create_spinlock(&lock) != UHDA_STATUS_SUCCESS) {
+		return nullptr;
+	}
+
+	auto* codec = construct<UhdaCodec>(ptr, controller, cid, move(arena));
+	codec->lock = lock;
+	return codec;
+}
+
+void UhdaCodec::destroy(UhdaCodec* codec) {
+	uhda_kernel_free_spinlock(codec->lock);
+
+	// the codec itself lives in the arena so it has to be moved out first
+	auto arena = move(codec->arena);
+	codec->~UhdaCodec();
+}
+
+ParamCache& UhdaCodec::param_cache() const {
+	return controller->param_caches[cid];
+}
+
 UhdaStatus UhdaCodec::init() {
+	auto status = get_parameter(0, param::VENDOR_ID, vendor_id);
+	if (status != UHDA_STATUS_SUCCESS) {
+		return status;
+	}
+
+	status = get_parameter(0, param::REVISION_ID, revision_id);
+	if (status != UHDA_STATUS_SUCCESS) {
+		return status;
+	}
+
+	// the cached parameters are only reused if the same codec is still present
+	if (!param_cache().matches(vendor_id, revision_id)) {
+		LockGuard guard {lock};
+		param_cache().reset(vendor_id, revision_id);
+	}
+
+	// the cache can't grow under the codec lock so room for the entries is made up front,
+	// failing to do so only means that some responses aren't cached
+	param_cache().reserve(CACHED_GROUP_PARAMS, lock);
+
 	uint32_t num_func_groups_resp;
-	auto status = get_parameter(0, param::NODE_COUNT, num_func_groups_resp);
+	status = get_parameter(0, param::NODE_COUNT, num_func_groups_resp);
 	if (status != UHDA_STATUS_SUCCESS) {
 		return status;
 	}
@@ -39,9 +93,41 @@ UhdaStatus UhdaCodec::init() {
 			return status;
 		}
 
+		// used by converters that don't report their own rates and formats
+		uint32_t default_rates;
+		status = get_parameter(func_group_i, param::SUPPORTED_RATES, default_rates);
+		if (status != UHDA_STATUS_SUCCESS) {
+			return status;
+		}
+
 		uint8_t num_widgets = num_widgets_resp & 0xFF;
 		uint8_t widgets_start_nid = num_widgets_resp >> 16 & 0xFF;
 
+		param_cache().reserve(
+			CACHED_GROUP_PARAMS + (widgets_start_nid + num_widgets) * CACHED_WIDGET_PARAMS,
+			lock);
+
+		// size the arena for the widgets and a few paths per widget up front
+		if (!arena.reserve(num_widgets * (sizeof(UhdaWidget) + 4 * sizeof(UhdaPath)))) {
+			return UHDA_STATUS_NO_MEMORY;
+		}
+
+		size_t nid_count = widgets_start_nid + num_widgets;
+		if (widget_types.size() < nid_count) {
+			size_t old_count = widget_types.size();
+			if (!widget_types.resize(nid_count) ||
+				!conn_offsets.resize(nid_count + 1) ||
+				!widgets.resize(nid_count) ||
+				!widget_states.resize(nid_count) ||
+				!conn_nids.reserve(conn_nids.size() + num_widgets * 2)) {
+				return UHDA_STATUS_NO_MEMORY;
+			}
+
+			for (size_t i = old_count; i < nid_count; ++i) {
+				widget_types[i] = NO_WIDGET;
+			}
+		}
+
 		for (uint8_t widget_i = widgets_start_nid; widget_i < widgets_start_nid + num_widgets; ++widget_i) {
 			uint32_t audio_caps;
 			uint32_t in_amp_caps;
@@ -93,8 +179,10 @@ UhdaStatus UhdaCodec::init() {
 				return UHDA_STATUS_UNSUPPORTED;
 			}
 
-			vector<uint8_t> connections;
 			uint8_t conn_list_len = conn_list_len_resp & 0x7F;
+			conn_offsets[widget_i] = static_cast<uint16_t>(conn_nids.size());
+
+			uint8_t prev_nid = 0;
 			for (uint8_t i = 0; i < conn_list_len; i += 4) {
 				uint32_t resp;
 				status = get_connection_list(widget_i, i, resp);
@@ -108,49 +196,37 @@ UhdaStatus UhdaCodec::init() {
 				}
 
 				for (uint8_t j = 0; j < count; ++j) {
-					uint8_t nid = resp >> (j * 8) & 0xFF;
-					if (!connections.push(nid)) {
-						return UHDA_STATUS_NO_MEMORY;
+					uint8_t entry = resp >> (j * 8) & 0xFF;
+
+					if (!(entry & 1 << 7)) {
+						if (!conn_nids.push(entry)) {
+							return UHDA_STATUS_NO_MEMORY;
+						}
+						prev_nid = entry;
+						continue;
 					}
-				}
-			}
 
-			uhda::vector<uint32_t> supported_sample_rates;
-			uhda::vector<UhdaFormat> supported_formats;
-
-#define ADD_RATE(bit, rate) do { \
-	if ((supported_rates & (1 << (bit))) && !supported_sample_rates.push(rate)) { \
-		return UHDA_STATUS_NO_MEMORY; \
-	} \
-} while (false)
-#define ADD_FMT(bit, fmt) do { \
-	if ((supported_rates & (1 << (bit))) && !supported_formats.push(fmt)) { \
-		return UHDA_STATUS_NO_MEMORY; \
-	} \
-} while (false)
-
-			if (supported_rates != 0) {
-				ADD_RATE(0, 8000);
-				ADD_RATE(1, 11025);
-				ADD_RATE(2, 16000);
-				ADD_RATE(3, 22050);
-				ADD_RATE(4, 32000);
-				ADD_RATE(5, 44100);
-				ADD_RATE(6, 48000);
-				ADD_RATE(7, 88200);
-				ADD_RATE(8, 96000);
-				ADD_RATE(9, 176400);
-				ADD_RATE(10, 192000);
-				ADD_FMT(16, UHDA_FORMAT_PCM8);
-				ADD_FMT(17, UHDA_FORMAT_PCM16);
-				ADD_FMT(18, UHDA_FORMAT_PCM20);
-				ADD_FMT(19, UHDA_FORMAT_PCM24);
-				ADD_FMT(20, UHDA_FORMAT_PCM32);
+					// a range includes every nid after the previous entry up to this one
+					uint8_t end = entry & 0x7F;
+					if (i + j == 0) {
+						uhda_kernel_log(
+							"warning: first connection list entry can't be a range, treating as an individual entry");
+						prev_nid = end - 1;
+					}
+					for (uint8_t nid = prev_nid + 1; nid <= end; ++nid) {
+						if (!conn_nids.push(nid)) {
+							return UHDA_STATUS_NO_MEMORY;
+						}
+					}
+					prev_nid = end;
+				}
 			}
 
+			conn_offsets[widget_i + 1] = static_cast<uint16_t>(conn_nids.size());
 
-#undef ADD_RATE
-#undef ADD_FMT
+			if (!supported_rates && (type == widget_type::AUDIO_OUT || type == widget_type::AUDIO_IN)) {
+				supported_rates = default_rates;
+			}
 
 			// set output amp, set left amp, set right amp and mute
 			uint16_t amp_data = 1 << 15 | 1 << 13 | 1 << 12 | 1 << 7;
@@ -165,26 +241,21 @@ UhdaStatus UhdaCodec::init() {
 
 			UhdaWidget widget {
 				.codec = this,
-				.connections {move(connections)},
-				.supported_sample_rates {move(supported_sample_rates)},
-				.supported_formats {move(supported_formats)},
 				.in_amp_caps = in_amp_caps,
 				.out_amp_caps = out_amp_caps,
 				.pin_caps = pin_caps,
 				.default_config = default_config,
 				.supported_rates = supported_rates,
 				.nid = widget_i,
-				.type = type,
 				.default_dev = static_cast<uint8_t>(default_config >> 20 & 0xF),
+				// channel count extension in bits 15:13 and stereo in bit 0
+				.channels = static_cast<uint8_t>(((audio_caps >> 12 & 0b1110) | (audio_caps & 1)) + 1),
 				.trigger = trigger,
-				.presence_detect = !no_presence_detect && presence_detect
+				.presence_detect = !no_presence_detect && presence_detect,
+				.unsol_capable = static_cast<bool>(audio_caps & 1 << 7)
 			};
-			if (widgets.size() <= widget_i) {
-				if (!widgets.resize(widget_i + 1)) {
-					return UHDA_STATUS_NO_MEMORY;
-				}
-			}
 			widgets[widget_i] = move(widget);
+			widget_types[widget_i] = type;
 
 			if (type == widget_type::AUDIO_OUT) {
 				if (!dac_nids.push(widget_i)) {
@@ -228,37 +299,19 @@ UhdaStatus UhdaCodec::init() {
 			continue;
 		}
 
-		auto new_output_ptr = uhda_kernel_malloc(sizeof(UhdaOutput));
-		if (!new_output_ptr) {
-			return UHDA_STATUS_NO_MEMORY;
-		}
-		auto* new_output = construct<UhdaOutput>(new_output_ptr, UhdaOutput {
+		auto* new_output = arena.create<UhdaOutput>(UhdaOutput {
 			.widget = &pin,
 			.sequence = sequence
 		});
+		if (!new_output) {
+			return UHDA_STATUS_NO_MEMORY;
+		}
 
 		if (assoc == 0b1111) {
 			// low-priority independent output
 
-			auto group_ptr = uhda_kernel_malloc(sizeof(UhdaOutputGroup));
-			if (!group_ptr) {
-				new_output->~UhdaOutput();
-				uhda_kernel_free(new_output, sizeof(UhdaOutput));
-				return UHDA_STATUS_NO_MEMORY;
-			}
-
-			auto* group = construct<UhdaOutputGroup>(group_ptr, assoc);
-			if (!group->outputs.push(new_output)) {
-				new_output->~UhdaOutput();
-				uhda_kernel_free(new_output, sizeof(UhdaOutput));
-				group->~UhdaOutputGroup();
-				uhda_kernel_free(group_ptr, sizeof(UhdaOutputGroup));
-				return UHDA_STATUS_NO_MEMORY;
-			}
-
-			if (!output_groups.push(group)) {
-				group->~UhdaOutputGroup();
-				uhda_kernel_free(group_ptr, sizeof(UhdaOutputGroup));
+			auto* group = arena.create<UhdaOutputGroup>(alloc(), assoc);
+			if (!group || !group->outputs.push(new_output) || !output_groups.push(group)) {
 				return UHDA_STATUS_NO_MEMORY;
 			}
 			continue;
@@ -291,26 +344,13 @@ UhdaStatus UhdaCodec::init() {
 			}
 		}
 		else {
-			auto group_ptr = uhda_kernel_malloc(sizeof(UhdaOutputGroup));
-			if (!group_ptr) {
-				new_output->~UhdaOutput();
-				uhda_kernel_free(new_output, sizeof(UhdaOutput));
-				return UHDA_STATUS_NO_MEMORY;
-			}
-
-			auto* new_group = construct<UhdaOutputGroup>(group_ptr, assoc);
-			if (!new_group->outputs.push(new_output)) {
-				new_output->~UhdaOutput();
-				uhda_kernel_free(new_output, sizeof(UhdaOutput));
-				new_group->~UhdaOutputGroup();
-				uhda_kernel_free(group_ptr, sizeof(UhdaOutputGroup));
+			auto* new_group = arena.create<UhdaOutputGroup>(alloc(), assoc);
+			if (!new_group || !new_group->outputs.push(new_output)) {
 				return UHDA_STATUS_NO_MEMORY;
 			}
 
 			if (output_groups.is_empty() || output_groups.back()->assoc <= assoc) {
 				if (!output_groups.push(new_group)) {
-					new_group->~UhdaOutputGroup();
-					uhda_kernel_free(group_ptr, sizeof(UhdaOutputGroup));
 					return UHDA_STATUS_NO_MEMORY;
 				}
 			}
@@ -318,8 +358,6 @@ UhdaStatus UhdaCodec::init() {
 				for (auto& output_group : output_groups) {
 					if (output_group->assoc > assoc) {
 						if (!output_groups.insert(&output_group, new_group)) {
-							new_group->~UhdaOutputGroup();
-							uhda_kernel_free(group_ptr, sizeof(UhdaOutputGroup));
 							return UHDA_STATUS_NO_MEMORY;
 						}
 						break;
@@ -329,18 +367,107 @@ UhdaStatus UhdaCodec::init() {
 		}
 	}
 
+	return enable_unsol();
+}
+
+UhdaStatus UhdaCodec::enable_unsol() {
+	for (auto group : output_groups) {
+		for (auto output : group->outputs) {
+			auto widget = output->widget;
+			if (!widget->presence_detect || !widget->unsol_capable) {
+				continue;
+			}
+
+			// the tag is 6 bits wide and 0 is reserved
+			if (unsol_outputs.size() == 0x3F) {
+				uhda_kernel_log("warning: too many outputs with presence detection, not enabling unsolicited responses");
+				return UHDA_STATUS_SUCCESS;
+			}
+
+			if (!unsol_outputs.push(output)) {
+				return UHDA_STATUS_NO_MEMORY;
+			}
+			output->unsol_tag = static_cast<uint8_t>(unsol_outputs.size());
+
+			auto status = set_unsol_enable(widget->nid, 1 << 7 | output->unsol_tag);
+			if (status != UHDA_STATUS_SUCCESS) {
+				return status;
+			}
+		}
+	}
+
 	return UHDA_STATUS_SUCCESS;
 }
 
+UhdaStatus UhdaCodec::update_presence(UhdaOutput* output, bool& presence) {
+	auto widget = output->widget;
+	clear_unsol(output);
+
+	if (widget->trigger) {
+		auto status = set_pin_sense(widget->nid, 0);
+		if (status != UHDA_STATUS_SUCCESS) {
+			return status;
+		}
+	}
+
+	uint32_t value;
+	auto status = get_pin_sense(widget->nid, value);
+	if (status != UHDA_STATUS_SUCCESS) {
+		return status;
+	}
+
+	presence = value & 1 << 31;
+	report_presence(output, presence);
+	return UHDA_STATUS_SUCCESS;
+}
+
+void UhdaCodec::report_presence(UhdaOutput* output, bool presence) {
+	UhdaPresenceFn fn = nullptr;
+	void* arg = nullptr;
+	{
+		LockGuard guard {lock};
+		if (!output->presence_valid || output->presence != presence) {
+			fn = output->presence_fn;
+			arg = output->presence_arg;
+		}
+		output->presence = presence;
+		// without unsolicited responses plug events are missed so the value can't be reused
+		output->presence_valid = output->unsol_tag;
+	}
+
+	if (fn) {
+		fn(output, presence, arg);
+	}
+}
+
+bool UhdaCodec::presence_cached(const UhdaOutput* output) const {
+	if (!output->presence_valid) {
+		return false;
+	}
+
+	LockGuard guard {controller->lock};
+	// unsolicited responses only arrive while the rings are running
+	return controller->verb_transport == UHDA_VERB_TRANSPORT_RINGS &&
+		!(unsol_pending & uint64_t {1} << output->unsol_tag);
+}
+
+void UhdaCodec::clear_unsol(const UhdaOutput* output) {
+	LockGuard guard {controller->lock};
+	unsol_pending &= ~(uint64_t {1} << output->unsol_tag);
+}
+
 UhdaStatus UhdaCodec::find_output_paths() {
+	static constexpr size_t MAX_PATH_DEPTH = UhdaPath::MAX_LENGTH - 1;
+
 	struct StackEntry {
-		UhdaWidget& widget;
-		uint8_t con_index;
-		uint8_t con_range_index;
-		uint8_t con_range_end;
+		uint8_t nid;
+		uint16_t con_index;
 	};
 
-	vector<StackEntry> stack;
+	StackEntry stack[MAX_PATH_DEPTH];
+	size_t depth = 0;
+	// nids currently on the stack
+	uint64_t visited[4] {};
 
 	for (auto pin_i : output_nids) {
 		auto& pin = widgets[pin_i];
@@ -354,90 +481,48 @@ UhdaStatus UhdaCodec::find_output_paths() {
 			continue;
 		}
 
-		if (!stack.push({
-			.widget = pin,
-			.con_index = 0,
-			.con_range_index = 0xFF,
-			.con_range_end = 0
-		})) {
-			return UHDA_STATUS_NO_MEMORY;
-		}
+		stack[depth++] = {.nid = pin_i, .con_index = 0};
+		visited[pin_i / 64] |= uint64_t {1} << (pin_i % 64);
 
-		while (true) {
-			if (stack.is_empty()) {
-				break;
-			}
-
-			auto* cur_entry = &stack.back();
-			auto& cur_widget = cur_entry->widget;
-			if (cur_entry->con_index == cur_widget.connections.size()) {
-				stack.pop();
+		while (depth) {
+			auto& cur_entry = stack[depth - 1];
+			if (cur_entry.con_index == connection_count(cur_entry.nid)) {
+				visited[cur_entry.nid / 64] &= ~(uint64_t {1} << (cur_entry.nid % 64));
+				--depth;
 				continue;
 			}
 
-			if (cur_entry->con_range_index > cur_entry->con_range_end) {
-				cur_entry->con_range_index = cur_widget.connections[cur_entry->con_index++];
-				if (cur_entry->con_range_index & 1 << 7) {
-					uhda_kernel_log(
-						"warning: first connection list entry can't be a range, treating as an individual entry");
-					cur_entry->con_range_index &= 0x7F;
-				}
-
-				if (cur_entry->con_index < cur_widget.connections.size() &&
-					cur_widget.connections[cur_entry->con_index] & 1 << 7) {
-					cur_entry->con_range_end = cur_widget.connections[cur_entry->con_index++] & 0x7F;
-				}
-				else {
-					cur_entry->con_range_end = cur_entry->con_range_index;
-				}
-			}
-
-			uint8_t nid = cur_entry->con_range_index++;
-			if (nid >= widgets.size()) {
+			uint8_t nid = connections(cur_entry.nid)[cur_entry.con_index++];
+			if (!has_widget(nid)) {
 				uhda_kernel_log("warning: invalid nid in connection list");
 				continue;
 			}
 
-			auto& assoc_widget = widgets[nid];
-			if (assoc_widget.type == widget_type::AUDIO_OUT) {
+			if (widget_types[nid] == widget_type::AUDIO_OUT) {
 				UhdaPath path {
 					.codec = this,
-					.widgets {},
+					.nids {},
+					.length = static_cast<uint8_t>(depth + 1),
 					.gain = 0
 				};
-				for (auto& entry : stack) {
-					if (!path.widgets.push(&entry.widget)) {
-						return UHDA_STATUS_NO_MEMORY;
-					}
-				}
-				if (!path.widgets.push(&assoc_widget)) {
-					return UHDA_STATUS_NO_MEMORY;
+				for (size_t i = 0; i < depth; ++i) {
+					path.nids[i] = stack[i].nid;
 				}
+				path.nids[depth] = nid;
 
-				if (!output_paths.push(move(path))) {
+				// decoded now as `uhda_path_get_info` can't allocate
+				if (!output_paths.push(path) || !decode_caps(path_supported_rates(path))) {
 					return UHDA_STATUS_NO_MEMORY;
 				}
 			}
 			else {
-				bool circular_path = false;
-				for (auto& entry : stack) {
-					if (&entry.widget == &assoc_widget) {
-						circular_path = true;
-						break;
-					}
-				}
-
-				if (circular_path || stack.size() >= 20) {
+				bool circular_path = visited[nid / 64] & uint64_t {1} << (nid % 64);
+				if (circular_path || depth >= MAX_PATH_DEPTH) {
 					continue;
 				}
-				if (!stack.push({
-					.widget = assoc_widget,
-					.con_index = 0,
-					.con_range_index = 0xFF,
-					.con_range_end = 0
-				})) {
-					return UHDA_STATUS_NO_MEMORY;
-				}
+
+				stack[depth++] = {.nid = nid, .con_index = 0};
+				visited[nid / 64] |= uint64_t {1} << (nid % 64);
 			}
 		}
 	}
@@ -445,114 +530,237 @@ UhdaStatus UhdaCodec::find_output_paths() {
 	return UHDA_STATUS_SUCCESS;
 }
 
+uint32_t UhdaCodec::path_supported_rates(const UhdaPath& path) const {
+	uint32_t supported = 0xFFFFFFFF;
+	for (size_t i = 0; i < path.length; ++i) {
+		auto rates = widgets[path.nids[i]].supported_rates;
+		// widgets that don't report anything don't restrict the path
+		if (rates) {
+			supported &= rates;
+		}
+	}
+
+	// only the known rates and formats
+	return supported & (0x7FF | 0x1F << 16);
+}
+
+const UhdaDecodedCaps* UhdaCodec::find_caps(uint32_t supported_rates) const {
+	for (auto caps : decoded_caps) {
+		if (caps->supported_rates == supported_rates) {
+			return caps;
+		}
+	}
+	return nullptr;
+}
+
+const UhdaDecodedCaps* UhdaCodec::decode_caps(uint32_t supported_rates) {
+	// 384 kHz (bit 11) can't be programmed in the stream format, so it isn't reported
+	static constexpr uint32_t RATES[] {
+		8000, 11025, 16000, 22050, 32000, 44100, 48000, 88200, 96000, 176400, 192000
+	};
+
+	if (auto existing = find_caps(supported_rates)) {
+		return existing;
+	}
+
+	auto* caps = arena.create<UhdaDecodedCaps>();
+	if (!caps || !decoded_caps.push(caps)) {
+		return nullptr;
+	}
+
+	caps->supported_rates = supported_rates;
+	for (uint8_t i = 0; i < sizeof(RATES) / sizeof(*RATES); ++i) {
+		if (supported_rates & 1 << i) {
+			caps->sample_rates[caps->sample_rate_count++] = RATES[i];
+		}
+	}
+	for (uint8_t i = UHDA_FORMAT_PCM8; i <= UHDA_FORMAT_PCM32; ++i) {
+		if (supported_rates & 1 << (16 + i)) {
+			caps->formats[caps->format_count++] = static_cast<UhdaFormat>(i);
+		}
+	}
+
+	return caps;
+}
+
 UhdaStatus UhdaCodec::get_parameter(uint8_t nid, uint8_t param, uint32_t& res) const {
-	LockGuard guard {controller->lock};
+	LockGuard guard {lock};
 
-	auto index = controller->submit_verb(cid, nid, cmd::GET_PARAM, param);
-	ResponseDescriptor resp {};
-	auto status = controller->wait_for_verb(index, resp);
-	res = resp.resp;
+	// the ids are what the cache is validated with so they always come from the codec
+	bool cacheable = param != param::VENDOR_ID && param != param::REVISION_ID;
+	if (cacheable && param_cache().get(nid, param, res)) {
+		return UHDA_STATUS_SUCCESS;
+	}
+
+	auto status = send_verb(nid, cmd::GET_PARAM, param, res);
+	if (cacheable && status == UHDA_STATUS_SUCCESS) {
+		param_cache().insert(nid, param, res);
+	}
 	return status;
 }
 
 UhdaStatus UhdaCodec::get_connection_list(uint8_t nid, uint8_t offset_index, uint32_t& res) const {
-	LockGuard guard {controller->lock};
-
-	auto index = controller->submit_verb(cid, nid, cmd::GET_CONN_LIST, offset_index);
-	ResponseDescriptor resp {};
-	auto status = controller->wait_for_verb(index, resp);
-	res = resp.resp;
-	return status;
+	LockGuard guard {lock};
+	return send_verb(nid, cmd::GET_CONN_LIST, offset_index, res);
 }
 
 UhdaStatus UhdaCodec::get_config_default(uint8_t nid, uint32_t& res) const {
-	LockGuard guard {controller->lock};
+	LockGuard guard {lock};
 
-	auto index = controller->submit_verb(cid, nid, cmd::GET_CONFIG_DEFAULT, 0);
-	ResponseDescriptor resp {};
-	auto status = controller->wait_for_verb(index, resp);
-	res = resp.resp;
+	if (param_cache().get(nid, ParamCache::CONFIG_DEFAULT, res)) {
+		return UHDA_STATUS_SUCCESS;
+	}
+
+	auto status = send_verb(nid, cmd::GET_CONFIG_DEFAULT, 0, res);
+	if (status == UHDA_STATUS_SUCCESS) {
+		param_cache().insert(nid, ParamCache::CONFIG_DEFAULT, res);
+	}
 	return status;
 }
 
 UhdaStatus UhdaCodec::get_pin_sense(uint8_t nid, uint32_t& res) const {
-	LockGuard guard {controller->lock};
+	LockGuard guard {lock};
+	return send_verb(nid, cmd::GET_PIN_SENSE, 0, res);
+}
+
+UhdaStatus UhdaCodec::send_verbs(const VerbDescriptor* verbs, uint8_t count, ResponseDescriptor* res) const {
+	if (controller->verb_transport == UHDA_VERB_TRANSPORT_IMMEDIATE) {
+		LockGuard guard {controller->lock};
+		for (uint8_t i = 0; i < count; ++i) {
+			auto status = controller->send_immediate(verbs[i], res[i]);
+			if (status != UHDA_STATUS_SUCCESS) {
+				return status;
+			}
+		}
+		return UHDA_STATUS_SUCCESS;
+	}
 
-	auto index = controller->submit_verb(cid, nid, cmd::GET_PIN_SENSE, 0);
+	{
+		LockGuard guard {controller->lock};
+		// drop responses left behind by verbs that timed out
+		response_tail = response_head;
+		auto status = controller->submit_verbs(verbs, count);
+		if (status != UHDA_STATUS_SUCCESS) {
+			return status;
+		}
+	}
+
+	return controller->wait_for_responses(this, res, count);
+}
+
+UhdaStatus UhdaCodec::send_verb(uint8_t nid, uint16_t cmd, uint16_t data, uint32_t& res) const {
+	auto verb = VerbDescriptor::make(cid, nid, cmd, data);
 	ResponseDescriptor resp {};
-	auto status = controller->wait_for_verb(index, resp);
+	auto status = send_verbs(&verb, 1, &resp);
 	res = resp.resp;
 	return status;
 }
 
-UhdaStatus UhdaCodec::set_selected_connection(uint8_t nid, uint8_t index) const {
-	LockGuard guard {controller->lock};
+UhdaStatus UhdaCodec::send_control(uint8_t nid, uint16_t cmd, uint16_t data) {
+	++stats.verbs_sent;
 
-	auto submit_index = controller->submit_verb(cid, nid, cmd::SET_CONN_SELECT, index);
-	ResponseDescriptor resp {};
-	return controller->wait_for_verb(submit_index, resp);
+	uint32_t resp;
+	return send_verb(nid, cmd, data, resp);
 }
 
-UhdaStatus UhdaCodec::set_amp_gain_mute(uint8_t nid, uint16_t data) const {
-	LockGuard guard {controller->lock};
+UhdaStatus UhdaCodec::update_control(uint8_t nid, uint16_t UhdaWidgetState::* state, uint16_t cmd, uint16_t data) {
+	if (nid >= widget_states.size()) {
+		return send_control(nid, cmd, data);
+	}
 
-	auto index = controller->submit_verb_long(cid, nid, cmd::SET_AMP_GAIN_MUTE, data);
-	ResponseDescriptor resp {};
-	return controller->wait_for_verb(index, resp);
-}
+	auto& value = widget_states[nid].*state;
+	if (value == data) {
+		++stats.verbs_skipped;
+		return UHDA_STATUS_SUCCESS;
+	}
 
-UhdaStatus UhdaCodec::set_converter_format(uint8_t nid, uint16_t format) const {
-	LockGuard guard {controller->lock};
+	auto status = send_control(nid, cmd, data);
+	value = status == UHDA_STATUS_SUCCESS ? data : UhdaWidgetState::UNKNOWN;
+	return status;
+}
 
-	auto index = controller->submit_verb_long(cid, nid, cmd::SET_CONVERTER_FORMAT, format);
-	ResponseDescriptor resp {};
-	return controller->wait_for_verb(index, resp);
+UhdaStatus UhdaCodec::set_selected_connection(uint8_t nid, uint8_t index) {
+	LockGuard guard {lock};
+	return update_control(nid, &UhdaWidgetState::conn_select, cmd::SET_CONN_SELECT, index);
 }
 
-UhdaStatus UhdaCodec::set_converter_control(uint8_t nid, uint8_t stream, uint8_t channel) const {
-	LockGuard guard {controller->lock};
+UhdaStatus UhdaCodec::set_amp_gain_mute(uint8_t nid, uint16_t data) {
+	LockGuard guard {lock};
 
-	auto index = controller->submit_verb(cid, nid, cmd::SET_CONVERTER_CONTROL, channel | stream << 4);
-	ResponseDescriptor resp {};
-	return controller->wait_for_verb(index, resp);
-}
+	if (nid >= widget_states.size() || !(data & 1 << 15)) {
+		return send_control(nid, cmd::SET_AMP_GAIN_MUTE, data);
+	}
 
-UhdaStatus UhdaCodec::set_pin_control(uint8_t nid, uint8_t data) const {
-	LockGuard guard {controller->lock};
+	// only the output amp is tracked, writes that also touch the input amps are always sent
+	auto& state = widget_states[nid];
+	uint16_t* left = data & 1 << 13 ? &state.out_amp[0] : nullptr;
+	uint16_t* right = data & 1 << 12 ? &state.out_amp[1] : nullptr;
+	uint16_t value = data & 0xFF;
 
-	auto index = controller->submit_verb(cid, nid, cmd::SET_PIN_CONTROL, data);
-	ResponseDescriptor resp {};
-	return controller->wait_for_verb(index, resp);
+	if (!(data & 1 << 14) && (left || right) &&
+		(!left || *left == value) && (!right || *right == value)) {
+		++stats.verbs_skipped;
+		return UHDA_STATUS_SUCCESS;
+	}
+
+	auto status = send_control(nid, cmd::SET_AMP_GAIN_MUTE, data);
+	if (status != UHDA_STATUS_SUCCESS) {
+		value = UhdaWidgetState::UNKNOWN;
+	}
+	if (left) {
+		*left = value;
+	}
+	if (right) {
+		*right = value;
+	}
+	return status;
 }
 
-UhdaStatus UhdaCodec::set_pin_sense(uint8_t nid, uint8_t data) const {
-	LockGuard guard {controller->lock};
+UhdaStatus UhdaCodec::set_converter_format(uint8_t nid, uint16_t format) {
+	LockGuard guard {lock};
+	return update_control(nid, &UhdaWidgetState::converter_format, cmd::SET_CONVERTER_FORMAT, format);
+}
 
-	auto index = controller->submit_verb(cid, nid, cmd::SET_PIN_SENSE, data);
-	ResponseDescriptor resp {};
-	return controller->wait_for_verb(index, resp);
+UhdaStatus UhdaCodec::set_converter_control(uint8_t nid, uint8_t stream, uint8_t channel) {
+	LockGuard guard {lock};
+	return update_control(
+		nid,
+		&UhdaWidgetState::converter_control,
+		cmd::SET_CONVERTER_CONTROL,
+		channel | stream << 4);
 }
 
-UhdaStatus UhdaCodec::set_eapd_enable(uint8_t nid, uint8_t data) const {
-	LockGuard guard {controller->lock};
+UhdaStatus UhdaCodec::set_pin_control(uint8_t nid, uint8_t data) {
+	LockGuard guard {lock};
+	return update_control(nid, &UhdaWidgetState::pin_control, cmd::SET_PIN_CONTROL, data);
+}
 
-	auto index = controller->submit_verb(cid, nid, cmd::SET_EAPD_ENABLE, data);
-	ResponseDescriptor resp {};
-	return controller->wait_for_verb(index, resp);
+UhdaStatus UhdaCodec::set_pin_sense(uint8_t nid, uint8_t data) {
+	LockGuard guard {lock};
+	// triggers an impedance measurement so it is never redundant
+	return send_control(nid, cmd::SET_PIN_SENSE, data);
 }
 
-UhdaStatus UhdaCodec::set_converter_channel_count(uint8_t nid, uint8_t count) const {
-	LockGuard guard {controller->lock};
+UhdaStatus UhdaCodec::set_eapd_enable(uint8_t nid, uint8_t data) {
+	LockGuard guard {lock};
+	return update_control(nid, &UhdaWidgetState::eapd, cmd::SET_EAPD_ENABLE, data);
+}
 
-	auto index = controller->submit_verb(cid, nid, cmd::SET_CONVERTER_CHANNEL_COUNT, count);
-	ResponseDescriptor resp {};
-	return controller->wait_for_verb(index, resp);
+UhdaStatus UhdaCodec::set_converter_channel_count(uint8_t nid, uint8_t count) {
+	LockGuard guard {lock};
+	return update_control(
+		nid,
+		&UhdaWidgetState::converter_channel_count,
+		cmd::SET_CONVERTER_CHANNEL_COUNT,
+		count);
 }
 
-UhdaStatus UhdaCodec::set_power_state(uint8_t nid, uint8_t data) const {
-	LockGuard guard {controller->lock};
+UhdaStatus UhdaCodec::set_power_state(uint8_t nid, uint8_t data) {
+	LockGuard guard {lock};
+	return update_control(nid, &UhdaWidgetState::power_state, cmd::SET_POWER_STATE, data);
+}
 
-	auto index = controller->submit_verb(cid, nid, cmd::SET_POWER_STATE, data);
-	ResponseDescriptor resp {};
-	return controller->wait_for_verb(index, resp);
+UhdaStatus UhdaCodec::set_unsol_enable(uint8_t nid, uint8_t data) {
+	LockGuard guard {lock};
+	return send_control(nid, cmd::SET_UNSOL_ENABLE, data);
 }
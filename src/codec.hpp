@@ -1,6 +1,9 @@
 #pragma once
 
 #include "uhda/types.h"
+#include "arena.hpp"
+#include "param_cache.hpp"
+#include "spec.hpp"
 #include "widget.hpp"
 #include "vector.hpp"
 
@@ -9,63 +12,173 @@ struct UhdaController;
 struct UhdaCodec;
 
 struct UhdaPath {
+	// the deepest path the search follows plus the converter
+	static constexpr uint8_t MAX_LENGTH = 21;
+
+	[[nodiscard]] uint8_t pin() const {
+		return nids[0];
+	}
+
+	[[nodiscard]] uint8_t converter() const {
+		return nids[length - 1];
+	}
+
 	UhdaCodec* codec;
-	uhda::vector<UhdaWidget*> widgets;
+	// nids from the pin to the converter
+	uint8_t nids[MAX_LENGTH];
+	uint8_t length;
 	uint8_t gain;
 };
 
 struct UhdaOutput {
 	UhdaWidget* widget;
 	uint8_t sequence;
+	// tag of the unsolicited responses of the pin, 0 if they aren't enabled
+	uint8_t unsol_tag {};
+	bool presence {};
+	bool presence_valid {};
+	UhdaPresenceFn presence_fn {};
+	void* presence_arg {};
 };
 
 struct UhdaOutputGroup {
-	explicit UhdaOutputGroup(uint8_t assoc) : assoc {assoc} {}
+	UhdaOutputGroup(uhda::ArenaAllocator alloc, uint8_t assoc) : outputs {alloc}, assoc {assoc} {}
 
-	~UhdaOutputGroup() {
-		for (auto output : outputs) {
-			output->~UhdaOutput();
-			uhda_kernel_free(output, sizeof(UhdaOutput));
-		}
-	}
-
-	uhda::vector<UhdaOutput*> outputs;
+	uhda::small_vector<UhdaOutput*, 0, uhda::ArenaAllocator> outputs;
 	uint8_t assoc;
 };
 
+/*
+ * Supported rates and formats decoded into the lists returned by `uhda_path_get_info`.
+ */
+struct UhdaDecodedCaps {
+	uint32_t supported_rates;
+	uint32_t sample_rates[11];
+	UhdaFormat formats[5];
+	uint8_t sample_rate_count;
+	uint8_t format_count;
+};
+
+/*
+ * The codec and its whole topology (widgets, paths, output groups and outputs)
+ * live in the codec's arena and are released together in `destroy`.
+ *
+ * Verbs to a codec and its state are serialized by the codec's own lock,
+ * the controller lock is only taken for short corb/rirb accesses, so codecs don't wait on each other.
+ *
+ * The graph is stored as dense nid-indexed arrays, the widget types and connections
+ * that are walked during the path search are kept apart from the rest of the widget data.
+ * Connections are stored in compressed sparse row form with ranges already expanded,
+ * so the connections of `nid` are `conn_nids[conn_offsets[nid]..conn_offsets[nid + 1]]`.
+ */
 struct UhdaCodec {
-	UhdaCodec(UhdaController* controller, uint8_t cid) : controller {controller}, cid {cid} {}
+	// widget type of nids that don't belong to an audio function group
+	static constexpr uint8_t NO_WIDGET = 0xFF;
+
+	UhdaCodec(UhdaController* controller, uint8_t cid, uhda::Arena&& arena)
+		: controller {controller}, arena {uhda::move(arena)}, cid {cid} {}
+
+	static UhdaCodec* create(UhdaController* controller, uint8_t cid);
+	static void destroy(UhdaCodec* codec);
 
-	~UhdaCodec() {
-		for (auto group : output_groups) {
-			group->~UhdaOutputGroup();
-			uhda_kernel_free(group, sizeof(UhdaOutputGroup));
-		}
+	[[nodiscard]] uhda::ArenaAllocator alloc() {
+		return {&arena};
+	}
+
+	[[nodiscard]] uhda::ParamCache& param_cache() const;
+
+	[[nodiscard]] bool has_widget(uint8_t nid) const {
+		return nid < widget_types.size() && widget_types[nid] != NO_WIDGET;
+	}
+
+	[[nodiscard]] const uint8_t* connections(uint8_t nid) const {
+		return conn_nids.data() + conn_offsets[nid];
+	}
+
+	[[nodiscard]] uint16_t connection_count(uint8_t nid) const {
+		return conn_offsets[nid + 1] - conn_offsets[nid];
 	}
 
 	UhdaStatus init();
+	/*
+	 * Gets the decoded lists for a SUPPORTED_RATES value, they are created on first use
+	 * and shared between all the paths of the codec.
+	 * Note: this allocates, so it's only called while enumerating the codec.
+	 */
+	const UhdaDecodedCaps* decode_caps(uint32_t supported_rates);
+	// gets the decoded lists created by `decode_caps` without creating them
+	[[nodiscard]] const UhdaDecodedCaps* find_caps(uint32_t supported_rates) const;
+	// the SUPPORTED_RATES bits supported by every widget of the path
+	[[nodiscard]] uint32_t path_supported_rates(const UhdaPath& path) const;
 	UhdaStatus find_output_paths();
+	UhdaStatus enable_unsol();
+
+	/*
+	 * Reads the presence from the pin and updates the cached value,
+	 * the presence callback is called if the presence changed.
+	 */
+	UhdaStatus update_presence(UhdaOutput* output, bool& presence);
+	void report_presence(UhdaOutput* output, bool presence);
+	/*
+	 * Returns whether the cached presence of the output can be used,
+	 * must be called with the codec lock held.
+	 */
+	[[nodiscard]] bool presence_cached(const UhdaOutput* output) const;
+	// forgets an unsolicited response from the output before its presence is read
+	void clear_unsol(const UhdaOutput* output);
 
 	UhdaStatus get_parameter(uint8_t nid, uint8_t param, uint32_t& res) const;
 	UhdaStatus get_connection_list(uint8_t nid, uint8_t offset_index, uint32_t& res) const;
 	UhdaStatus get_pin_sense(uint8_t nid, uint32_t& res) const;
 	UhdaStatus get_config_default(uint8_t nid, uint32_t& res) const;
 
-	[[nodiscard]] UhdaStatus set_selected_connection(uint8_t nid, uint8_t index) const;
-	[[nodiscard]] UhdaStatus set_amp_gain_mute(uint8_t nid, uint16_t data) const;
-	[[nodiscard]] UhdaStatus set_converter_format(uint8_t nid, uint16_t format) const;
-	[[nodiscard]] UhdaStatus set_converter_control(uint8_t nid, uint8_t stream, uint8_t channel) const;
-	[[nodiscard]] UhdaStatus set_pin_control(uint8_t nid, uint8_t data) const;
-	[[nodiscard]] UhdaStatus set_pin_sense(uint8_t nid, uint8_t data) const;
-	[[nodiscard]] UhdaStatus set_eapd_enable(uint8_t nid, uint8_t data) const;
-	[[nodiscard]] UhdaStatus set_converter_channel_count(uint8_t nid, uint8_t count) const;
-	[[nodiscard]] UhdaStatus set_power_state(uint8_t nid, uint8_t data) const;
+	[[nodiscard]] UhdaStatus set_selected_connection(uint8_t nid, uint8_t index);
+	[[nodiscard]] UhdaStatus set_amp_gain_mute(uint8_t nid, uint16_t data);
+	[[nodiscard]] UhdaStatus set_converter_format(uint8_t nid, uint16_t format);
+	[[nodiscard]] UhdaStatus set_converter_control(uint8_t nid, uint8_t stream, uint8_t channel);
+	[[nodiscard]] UhdaStatus set_pin_control(uint8_t nid, uint8_t data);
+	[[nodiscard]] UhdaStatus set_pin_sense(uint8_t nid, uint8_t data);
+	[[nodiscard]] UhdaStatus set_eapd_enable(uint8_t nid, uint8_t data);
+	[[nodiscard]] UhdaStatus set_converter_channel_count(uint8_t nid, uint8_t count);
+	[[nodiscard]] UhdaStatus set_power_state(uint8_t nid, uint8_t data);
+	[[nodiscard]] UhdaStatus set_unsol_enable(uint8_t nid, uint8_t data);
+
+	/*
+	 * Sends verbs to the codec and waits for their responses.
+	 * The codec lock must be held by all of these.
+	 */
+	UhdaStatus send_verbs(const uhda::VerbDescriptor* verbs, uint8_t count, uhda::ResponseDescriptor* res) const;
+	UhdaStatus send_verb(uint8_t nid, uint16_t cmd, uint16_t data, uint32_t& res) const;
+	UhdaStatus send_control(uint8_t nid, uint16_t cmd, uint16_t data);
+	UhdaStatus update_control(uint8_t nid, uint16_t UhdaWidgetState::* state, uint16_t cmd, uint16_t data);
 
 	UhdaController* controller;
-	uhda::vector<UhdaWidget> widgets;
-	uhda::vector<uint8_t> dac_nids;
-	uhda::vector<uint8_t> output_nids;
-	uhda::vector<UhdaPath> output_paths;
-	uhda::vector<UhdaOutputGroup*> output_groups;
+	uhda::Arena arena;
+	uhda::small_vector<uint8_t, 0, uhda::ArenaAllocator> widget_types {alloc()};
+	uhda::small_vector<uint16_t, 0, uhda::ArenaAllocator> conn_offsets {alloc()};
+	uhda::small_vector<uint8_t, 0, uhda::ArenaAllocator> conn_nids {alloc()};
+	uhda::small_vector<UhdaWidget, 0, uhda::ArenaAllocator> widgets {alloc()};
+	uhda::small_vector<UhdaWidgetState, 0, uhda::ArenaAllocator> widget_states {alloc()};
+	uhda::small_vector<uint8_t, 0, uhda::ArenaAllocator> dac_nids {alloc()};
+	uhda::small_vector<uint8_t, 0, uhda::ArenaAllocator> output_nids {alloc()};
+	uhda::small_vector<UhdaPath, 0, uhda::ArenaAllocator> output_paths {alloc()};
+	uhda::small_vector<UhdaOutputGroup*, 0, uhda::ArenaAllocator> output_groups {alloc()};
+	uhda::small_vector<UhdaDecodedCaps*, 0, uhda::ArenaAllocator> decoded_caps {alloc()};
+	// indexed by unsolicited response tag - 1
+	uhda::small_vector<UhdaOutput*, 0, uhda::ArenaAllocator> unsol_outputs {alloc()};
+	UhdaCodecStats stats {};
+	void* lock {};
+
+	static constexpr uint8_t RESPONSE_QUEUE_SIZE = 64;
+	// solicited responses routed to the codec from the rirb, protected by the controller lock
+	mutable uhda::ResponseDescriptor responses[RESPONSE_QUEUE_SIZE] {};
+	mutable uint8_t response_head {};
+	mutable uint8_t response_tail {};
+	// bits of the tags that sent unsolicited responses since their presence was read,
+	// protected by the controller lock
+	uint64_t unsol_pending {};
+
+	uint32_t vendor_id {};
+	uint32_t revision_id {};
 	uint8_t cid;
 };
@@ -1,5 +1,8 @@
 #include "controller.hpp"
+#include "dma_copy.hpp"
+#include "lock_guard.hpp"
 #include "uhda/kernel_api.h"
+#include "wait.hpp"
 
 namespace {
 	UhdaStatus pci_read_cmd(void* pci_device, uint16_t& cmd) {
@@ -20,10 +23,50 @@ namespace {
 		return uhda_kernel_pci_read(pci_device, 0x10 + bar * 4, 4, &value);
 	}
 
+	// replaces the bits in `mask` of a configuration space register with the ones from `value`
+	UhdaStatus pci_update(void* pci_device, uint8_t offset, uint8_t size, uint32_t mask, uint32_t value) {
+		uint32_t old;
+		if (auto status = uhda_kernel_pci_read(pci_device, offset, size, &old);
+			status != UHDA_STATUS_SUCCESS) {
+			return status;
+		}
+
+		uint32_t updated = (old & ~mask) | (value & mask);
+		if (updated == old) {
+			return UHDA_STATUS_SUCCESS;
+		}
+		return uhda_kernel_pci_write(pci_device, offset, size, updated);
+	}
+
 	enum {
 		PCI_CMD_MEM_SPACE = 1 << 1,
 		PCI_CMD_BUS_MASTER = 1 << 2
 	};
+
+	enum : uint16_t {
+		PCI_VENDOR_ATI = 0x1002,
+		PCI_VENDOR_AMD = 0x1022,
+		PCI_VENDOR_NVIDIA = 0x10DE,
+		PCI_VENDOR_INTEL = 0x8086
+	};
+
+	// vendor specific configuration space registers used to control snooping
+	namespace pci_reg {
+		// traffic class select, TC0 is needed by some codecs to play without static
+		constexpr uint8_t TCSEL = 0x44;
+		constexpr uint8_t INTEL_DEVC = 0x78;
+		constexpr uint16_t INTEL_DEVC_NOSNOOP = 1 << 11;
+		constexpr uint8_t ATI_MISC_CNTR2 = 0x42;
+		constexpr uint8_t ATI_ENABLE_SNOOP = 1 << 1;
+		constexpr uint8_t NVIDIA_TRANSREG = 0x4E;
+		constexpr uint8_t NVIDIA_ENABLE_COHBITS = 0xF;
+		constexpr uint8_t NVIDIA_OSTRM_COH = 0x4C;
+		constexpr uint8_t NVIDIA_ISTRM_COH = 0x4D;
+		constexpr uint8_t NVIDIA_ENABLE_COHBIT = 1 << 0;
+	}
+
+	constexpr uint32_t RESET_TIMEOUT_US = 2 * 1000 * 1000;
+	constexpr uint32_t VERB_TIMEOUT_US = 10 * 1000;
 }
 
 using namespace uhda;
@@ -33,9 +76,22 @@ using namespace uhda;
 UhdaController::~UhdaController() {
 	uhda_kernel_pci_enable_irq(pci_device, irq, false);
 
+	// the streams use the registers and the position buffer which are unmapped below
+	for (auto& stream : in_streams) {
+		stream.destroy();
+		stream.space.base = 0;
+	}
+	for (auto& stream : out_streams) {
+		stream.destroy();
+		stream.space.base = 0;
+	}
+	dma_cache.clear();
+
+	for (auto& slot : codec_slots) {
+		slot = nullptr;
+	}
 	for (auto codec : codecs) {
-		codec->~UhdaCodec();
-		uhda_kernel_free(codec, sizeof(UhdaCodec));
+		UhdaCodec::destroy(codec);
 	}
 
 	if (space.base) {
@@ -75,6 +131,18 @@ static bool hda_irq(void* arg) {
 		return false;
 	}
 
+	if (intsts & intsts::CIS) {
+		// clear the status first so responses arriving while draining raise a new interrupt
+		auto rirbsts = controller->space.load(regs::RIRBSTS);
+		controller->space.store(regs::RIRBSTS, rirbsts);
+
+		// no verbs are sent from here, the outputs are only marked and their pin sense is read later
+		LockGuard guard {controller->lock};
+		if (controller->unsol_enabled) {
+			controller->drain_rirb();
+		}
+	}
+
 	auto streams = intsts & intsts::SIS;
 
 	uint32_t stream_count = controller->in_stream_count + controller->out_stream_count;
@@ -91,25 +159,76 @@ static bool hda_irq(void* arg) {
 }
 
 UhdaStatus UhdaController::init() {
-	auto status = pci_setup();
+	auto status = init_resources();
 	if (status != UHDA_STATUS_SUCCESS) {
 		return status;
 	}
 
-	status = map_bar();
+	status = resume();
+	if (status != UHDA_STATUS_SUCCESS) {
+		uhda_kernel_pci_deallocate_irq(pci_device, irq);
+	}
+	return status;
+}
+
+UhdaStatus UhdaController::init_async(UhdaInitFn fn, void* arg) {
+	auto status = init_resources();
 	if (status != UHDA_STATUS_SUCCESS) {
 		return status;
 	}
 
-	uint32_t vendor_id;
-	status = uhda_kernel_pci_read(pci_device, 0, 2, &vendor_id);
+	init_fn = fn;
+	init_arg = arg;
+	resume_state = ResumeState::ENTER_RESET;
+	return UHDA_STATUS_SUCCESS;
+}
+
+bool UhdaController::poll_init(uint32_t& delay_us) {
+	delay_us = 0;
+	if (resume_state == ResumeState::DONE || resume_state == ResumeState::FAILED) {
+		return false;
+	}
+
+	bool done = false;
+	auto prev_state = resume_state;
+	auto prev_codec_count = codecs.size();
+	auto status = resume_step(done, delay_us);
+	if (status != UHDA_STATUS_SUCCESS) {
+		resume_state = ResumeState::FAILED;
+		init_fn(this, UHDA_INIT_STAGE_DONE, status, init_arg);
+		return false;
+	}
+
+	if (prev_state < ResumeState::ENUMERATE_START && resume_state >= ResumeState::ENUMERATE_START) {
+		init_fn(this, UHDA_INIT_STAGE_LINK_UP, UHDA_STATUS_SUCCESS, init_arg);
+	}
+	if (codecs.size() != prev_codec_count) {
+		init_fn(this, UHDA_INIT_STAGE_CODEC, UHDA_STATUS_SUCCESS, init_arg);
+	}
+
+	if (done) {
+		init_fn(this, UHDA_INIT_STAGE_DONE, UHDA_STATUS_SUCCESS, init_arg);
+		return false;
+	}
+	return true;
+}
+
+UhdaStatus UhdaController::init_resources() {
+	select_dma_copy();
+
+	auto status = pci_setup();
+	if (status != UHDA_STATUS_SUCCESS) {
+		return status;
+	}
+
+	status = map_bar();
 	if (status != UHDA_STATUS_SUCCESS) {
 		return status;
 	}
 
 	// apparently at least some nvidia cards may have issues when using msi.
 	UhdaIrqHint irq_hint;
-	if (vendor_id == 0x10DE) {
+	if (pci_vendor_id == PCI_VENDOR_NVIDIA) {
 		irq_hint = UHDA_IRQ_HINT_INTX;
 	}
 	else {
@@ -168,11 +287,6 @@ UhdaStatus UhdaController::init() {
 		goto fail;
 	}
 
-	status = resume();
-	if (status != UHDA_STATUS_SUCCESS) {
-		goto fail;
-	}
-
 	return UHDA_STATUS_SUCCESS;
 
 fail:
@@ -186,88 +300,203 @@ UhdaStatus UhdaController::destroy() {
 	return status;
 }
 
-UhdaStatus UhdaController::suspend() {
-	uhda_kernel_pci_enable_irq(pci_device, irq, false);
-
+bool UhdaController::enter_reset() {
 	auto gctl = space.load(regs::GCTL);
-	if (gctl & gctl::CRST) {
-		auto corbctl = space.load(regs::CORBCTL);
-		corbctl &= ~corbctl::RUN;
-		space.store(regs::CORBCTL, corbctl);
+	if (!(gctl & gctl::CRST)) {
+		return false;
+	}
 
-		auto rirbctl = space.load(regs::RIRBCTL);
-		rirbctl &= ~rirbctl::DMAEN;
-		space.store(regs::RIRBCTL, rirbctl);
+	auto corbctl = space.load(regs::CORBCTL);
+	corbctl &= ~corbctl::RUN;
+	space.store(regs::CORBCTL, corbctl);
 
-		auto gcap = space.load(regs::GCAP);
+	auto rirbctl = space.load(regs::RIRBCTL);
+	rirbctl &= ~rirbctl::DMAEN;
+	space.store(regs::RIRBCTL, rirbctl);
 
-		auto tmp_in_stream_count = gcap & gcap::ISS;
-		auto tmp_out_stream_count = gcap & gcap::OSS;
+	auto gcap = space.load(regs::GCAP);
 
-		for (int i = 0; i < tmp_in_stream_count; ++i) {
-			auto stream_space = space.subspace(0x80 + i * 0x20);
-			auto ctl0 = stream_space.load(regs::stream::CTL0);
-			ctl0 &= ~sdctl0::RUN;
-			stream_space.store(regs::stream::CTL0, ctl0);
-		}
+	auto tmp_in_stream_count = gcap & gcap::ISS;
+	auto tmp_out_stream_count = gcap & gcap::OSS;
 
-		for (int i = 0; i < tmp_out_stream_count; ++i) {
-			auto stream_space = space.subspace(0x80 + tmp_in_stream_count * 0x20 + i * 0x20);
-			auto ctl0 = stream_space.load(regs::stream::CTL0);
-			ctl0 &= ~sdctl0::RUN;
-			stream_space.store(regs::stream::CTL0, ctl0);
-		}
+	for (int i = 0; i < tmp_in_stream_count; ++i) {
+		auto stream_space = space.subspace(0x80 + i * 0x20);
+		auto ctl0 = stream_space.load(regs::stream::CTL0);
+		ctl0 &= ~sdctl0::RUN;
+		stream_space.store(regs::stream::CTL0, ctl0);
+	}
 
-		gctl &= ~gctl::CRST;
-		space.store(regs::GCTL, gctl);
+	for (int i = 0; i < tmp_out_stream_count; ++i) {
+		auto stream_space = space.subspace(0x80 + tmp_in_stream_count * 0x20 + i * 0x20);
+		auto ctl0 = stream_space.load(regs::stream::CTL0);
+		ctl0 &= ~sdctl0::RUN;
+		stream_space.store(regs::stream::CTL0, ctl0);
+	}
 
-		for (int i = 0;; ++i) {
-			if (i == 5 * 2000) {
-				uhda_kernel_pci_enable_irq(pci_device, irq, false);
-				return UHDA_STATUS_TIMEOUT;
-			}
+	gctl &= ~gctl::CRST;
+	space.store(regs::GCTL, gctl);
+	return true;
+}
 
-			if (!(space.load(regs::GCTL) & gctl::CRST)) {
-				break;
+UhdaStatus UhdaController::suspend() {
+	uhda_kernel_pci_enable_irq(pci_device, irq, false);
+	unsol_enabled = false;
+
+	if (enter_reset()) {
+		Deadline deadline {RESET_TIMEOUT_US};
+		while (space.load(regs::GCTL) & gctl::CRST) {
+			if (deadline.expired()) {
+				return UHDA_STATUS_TIMEOUT;
 			}
-			uhda_kernel_delay(200);
+			deadline.sleep(200);
 		}
 
-		uhda_kernel_delay(200);
+		uhda::sleep(200);
 	}
 
 	return UHDA_STATUS_SUCCESS;
 }
 
 UhdaStatus UhdaController::resume() {
-	auto status = pci_setup();
-	if (status != UHDA_STATUS_SUCCESS) {
-		return status;
-	}
-
-	status = suspend();
-	if (status != UHDA_STATUS_SUCCESS) {
-		return status;
-	}
+	resume_state = ResumeState::ENTER_RESET;
 
-	uhda_kernel_pci_enable_irq(pci_device, irq, true);
-
-	auto gctl = space.load(regs::GCTL);
-	gctl |= gctl::CRST(true);
-	space.store(regs::GCTL, gctl);
+	while (true) {
+		bool done = false;
+		uint32_t delay_us = 0;
+		auto status = resume_step(done, delay_us);
+		if (status != UHDA_STATUS_SUCCESS) {
+			resume_state = ResumeState::FAILED;
+			return status;
+		}
+		else if (done) {
+			return UHDA_STATUS_SUCCESS;
+		}
 
-	for (int i = 0;; ++i) {
-		if (i == 5 * 2000) {
-			uhda_kernel_pci_enable_irq(pci_device, irq, false);
-			return UHDA_STATUS_TIMEOUT;
+		if (delay_us) {
+			uhda::sleep(delay_us);
 		}
+	}
+}
 
-		if (space.load(regs::GCTL) & gctl::CRST) {
-			break;
+UhdaStatus UhdaController::resume_step(bool& done, uint32_t& delay_us) {
+	while (true) {
+		switch (resume_state) {
+			case ResumeState::ENTER_RESET:
+			{
+				auto status = pci_setup();
+				if (status != UHDA_STATUS_SUCCESS) {
+					return status;
+				}
+
+				uhda_kernel_pci_enable_irq(pci_device, irq, false);
+				unsol_enabled = false;
+
+				if (enter_reset()) {
+					resume_deadline = Deadline {RESET_TIMEOUT_US};
+					resume_state = ResumeState::WAIT_RESET;
+				}
+				else {
+					resume_state = ResumeState::LEAVE_RESET;
+				}
+				break;
+			}
+			case ResumeState::WAIT_RESET:
+				if (space.load(regs::GCTL) & gctl::CRST) {
+					if (resume_deadline.expired()) {
+						return UHDA_STATUS_TIMEOUT;
+					}
+					delay_us = 200;
+					resume_deadline.elapse(delay_us);
+					return UHDA_STATUS_SUCCESS;
+				}
+
+				resume_state = ResumeState::LEAVE_RESET;
+				delay_us = 200;
+				return UHDA_STATUS_SUCCESS;
+			case ResumeState::LEAVE_RESET:
+			{
+				uhda_kernel_pci_enable_irq(pci_device, irq, true);
+
+				auto gctl = space.load(regs::GCTL);
+				gctl |= gctl::CRST(true);
+				space.store(regs::GCTL, gctl);
+
+				resume_deadline = Deadline {RESET_TIMEOUT_US};
+				resume_state = ResumeState::WAIT_LINK;
+				break;
+			}
+			case ResumeState::WAIT_LINK:
+			{
+				if (!(space.load(regs::GCTL) & gctl::CRST)) {
+					if (resume_deadline.expired()) {
+						uhda_kernel_pci_enable_irq(pci_device, irq, false);
+						return UHDA_STATUS_TIMEOUT;
+					}
+					delay_us = 200;
+					resume_deadline.elapse(delay_us);
+					return UHDA_STATUS_SUCCESS;
+				}
+
+				auto status = setup_link();
+				if (status != UHDA_STATUS_SUCCESS) {
+					return status;
+				}
+
+				// wait for codec initialization
+				resume_state = ResumeState::ENUMERATE_START;
+				delay_us = 1000;
+				return UHDA_STATUS_SUCCESS;
+			}
+			case ResumeState::ENUMERATE_START:
+			{
+				auto intctl = space.load(regs::INTCTL);
+				intctl |= intctl::GIE(true);
+				intctl |= intctl::SIE((1 << (in_stream_count + out_stream_count)) - 1);
+				space.store(regs::INTCTL, intctl);
+
+				// the codecs are enumerated again from scratch, drop the topology from before the suspend
+				{
+					LockGuard guard {lock};
+					for (auto& slot : codec_slots) {
+						slot = nullptr;
+					}
+				}
+				for (auto codec : codecs) {
+					UhdaCodec::destroy(codec);
+				}
+				codecs.clear();
+
+				pending_codecs = space.load(regs::STATESTS) & 0x7FFF;
+				resume_state = ResumeState::ENUMERATE;
+				break;
+			}
+			case ResumeState::ENUMERATE:
+			{
+				if (!pending_codecs) {
+					// unsolicited responses are only received through the rirb
+					if (verb_transport == UHDA_VERB_TRANSPORT_RINGS) {
+						enable_unsol_irq();
+					}
+					resume_state = ResumeState::DONE;
+					done = true;
+					return UHDA_STATUS_SUCCESS;
+				}
+
+				// one codec per step so that asynchronous initialization yields in between
+				uint8_t cid = __builtin_ctz(pending_codecs);
+				pending_codecs &= ~(1U << cid);
+				return enumerate_codec(cid);
+			}
+			case ResumeState::DONE:
+				done = true;
+				return UHDA_STATUS_SUCCESS;
+			case ResumeState::FAILED:
+				return UHDA_STATUS_UNSUPPORTED;
 		}
-		uhda_kernel_delay(200);
 	}
+}
 
+UhdaStatus UhdaController::setup_link() {
 	auto gcap = space.load(regs::GCAP);
 	if (!(gcap & gcap::OK64)) {
 		uhda_kernel_pci_enable_irq(pci_device, irq, false);
@@ -323,13 +552,16 @@ UhdaStatus UhdaController::resume() {
 	space.store(regs::CORBUBASE, corb_phys >> 32);
 	space.store(regs::RIRBLBASE, rirb_phys);
 	space.store(regs::RIRBUBASE, rirb_phys >> 32);
-
-	auto corbctl = space.load(regs::CORBCTL);
-	corbctl |= corbctl::RUN(true);
-	space.store(regs::CORBCTL, corbctl);
-	auto rirbctl = space.load(regs::RIRBCTL);
-	rirbctl |= rirbctl::DMAEN(true);
-	space.store(regs::RIRBCTL, rirbctl);
+	rirb_rp = 0;
+	for (uint16_t i = 0; i < rirb_size; ++i) {
+		rirb[i].resp_ex = RIRB_EMPTY;
+	}
+	if (verb_transport == UHDA_VERB_TRANSPORT_RINGS) {
+		auto status = set_rings_running(true);
+		if (status != UHDA_STATUS_SUCCESS) {
+			return status;
+		}
+	}
 
 	auto rintcnt = space.load(regs::RINTCNT);
 	space.store(regs::RINTCNT, (rintcnt & ~0xFF) | 255);
@@ -345,6 +577,7 @@ UhdaStatus UhdaController::resume() {
 		in_streams[i].space = space.subspace(0x80 + i * 0x20);
 		in_streams[i].dma_pos = &dma_pos[i * 2];
 		in_streams[i].index = i;
+		in_streams[i].controller = this;
 		in_stream_ptrs[i] = &in_streams[i];
 	}
 
@@ -352,104 +585,385 @@ UhdaStatus UhdaController::resume() {
 		out_streams[i].space = space.subspace(0x80 + in_stream_count * 0x20 + i * 0x20);
 		out_streams[i].dma_pos = &dma_pos[in_stream_count * 2 + i * 2];
 		out_streams[i].index = i;
+		out_streams[i].controller = this;
 		out_streams[i].output = true;
 		out_stream_ptrs[i] = &out_streams[i];
 	}
 
-	// wait for codec initialization
-	uhda_kernel_delay(1000);
+	return UHDA_STATUS_SUCCESS;
+}
 
-	auto intctl = space.load(regs::INTCTL);
-	intctl |= intctl::GIE(true);
-	intctl |= intctl::SIE((1 << (in_stream_count + out_stream_count)) - 1);
-	space.store(regs::INTCTL, intctl);
+UhdaStatus UhdaController::enumerate_codec(uint8_t cid) {
+	auto* codec = UhdaCodec::create(this, cid);
+	if (!codec) {
+		return UHDA_STATUS_NO_MEMORY;
+	}
 
-	auto statests = space.load(regs::STATESTS);
-	for (uint32_t i = 0; i < 15; ++i) {
-		if (statests & 1 << i) {
-			auto* ptr = uhda_kernel_malloc(sizeof(UhdaCodec));
-			if (!ptr) {
-				return UHDA_STATUS_NO_MEMORY;
-			}
+	auto remove_codec = [&]() {
+		{
+			LockGuard guard {lock};
+			codec_slots[cid] = nullptr;
+		}
+		UhdaCodec::destroy(codec);
+	};
 
-			auto* codec = construct<UhdaCodec>(ptr, this, static_cast<uint8_t>(i));
-			status = codec->init();
-			if (status == UHDA_STATUS_TIMEOUT) {
-				codec->~UhdaCodec();
-				uhda_kernel_free(ptr, sizeof(UhdaCodec));
-				continue;
-			}
-			else if (status != UHDA_STATUS_SUCCESS) {
-				codec->~UhdaCodec();
-				uhda_kernel_free(ptr, sizeof(UhdaCodec));
-				return status;
-			}
+	{
+		LockGuard guard {lock};
+		codec_slots[cid] = codec;
+	}
 
-			if (!codecs.push(codec)) {
-				return UHDA_STATUS_NO_MEMORY;
-			}
-		}
+	auto status = codec->init();
+	if (status == UHDA_STATUS_TIMEOUT) {
+		// a codec that doesn't respond is left out instead of failing the whole controller
+		remove_codec();
+		return UHDA_STATUS_SUCCESS;
+	}
+	else if (status != UHDA_STATUS_SUCCESS) {
+		remove_codec();
+		return status;
+	}
+
+	if (!codecs.push(codec)) {
+		remove_codec();
+		return UHDA_STATUS_NO_MEMORY;
 	}
 
 	return UHDA_STATUS_SUCCESS;
 }
 
-uint8_t UhdaController::submit_verb(uint8_t cid, uint8_t nid, uint16_t cmd, uint8_t data) {
-	uint8_t index = (space.load(regs::CORBWP) & corbwp::WP) + 1;
+void UhdaController::enable_unsol_irq() {
+	// accept unsolicited responses only once the codecs they are dispatched to exist
+	for (auto codec : codecs) {
+		if (!codec->unsol_outputs.is_empty()) {
+			unsol_enabled = true;
+			break;
+		}
+	}
 
-	VerbDescriptor verb {};
-	verb.set_cid(cid);
-	verb.set_nid(nid);
-	verb.set_payload(cmd << 8 | data);
-	corb[index] = verb;
+	if (unsol_enabled) {
+		// the response interrupt count stays large, the controller also interrupts once the responses stop
+		// arriving so an unsolicited response is noticed without a pending verb
+		auto rirbctl = space.load(regs::RIRBCTL);
+		rirbctl |= rirbctl::INTCTL(true);
+		space.store(regs::RIRBCTL, rirbctl);
 
-	auto corbwp_reg = space.load(regs::CORBWP);
-	corbwp_reg &= ~corbwp::WP;
-	corbwp_reg |= corbwp::WP(index);
-	space.store(regs::CORBWP, corbwp_reg);
+		auto intctl = space.load(regs::INTCTL);
+		intctl |= intctl::CIE(true);
+		space.store(regs::INTCTL, intctl);
 
-	return index;
+		auto gctl = space.load(regs::GCTL);
+		gctl |= gctl::UNSOL(true);
+		space.store(regs::GCTL, gctl);
+	}
 }
 
-uint8_t UhdaController::submit_verb_long(uint8_t cid, uint8_t nid, uint8_t cmd, uint16_t data) {
-	uint8_t index = (space.load(regs::CORBWP) & corbwp::WP) + 1;
+UhdaStatus UhdaController::submit_verbs(const uhda::VerbDescriptor* verbs, uint8_t count) {
+	if (count >= corb_size) {
+		return UHDA_STATUS_UNSUPPORTED;
+	}
+
+	uint8_t index = space.load(regs::CORBWP) & corbwp::WP;
+
+	// other codecs may have verbs in flight, entries the controller hasn't fetched yet must not be overwritten
+	Deadline deadline {VERB_TIMEOUT_US};
+	while (true) {
+		uint8_t rp = space.load(regs::CORBRP) & corbrp::RP;
+		uint16_t in_flight = (index + corb_size - rp) % corb_size;
+		if (in_flight + count < corb_size) {
+			break;
+		}
+		if (deadline.expired()) {
+			return UHDA_STATUS_TIMEOUT;
+		}
+		deadline.poll();
+	}
 
-	VerbDescriptor verb {};
-	verb.set_cid(cid);
-	verb.set_nid(nid);
-	verb.set_payload(cmd << 16 | data);
-	corb[index] = verb;
+	for (uint8_t i = 0; i < count; ++i) {
+		index = (index + 1) % corb_size;
+		corb[index] = verbs[i];
+	}
 
 	auto corbwp_reg = space.load(regs::CORBWP);
 	corbwp_reg &= ~corbwp::WP;
 	corbwp_reg |= corbwp::WP(index);
 	space.store(regs::CORBWP, corbwp_reg);
-
-	return index;
+	return UHDA_STATUS_SUCCESS;
 }
 
-UhdaStatus UhdaController::wait_for_verb(uint8_t index, uhda::ResponseDescriptor& res) {
-	for (int i = 0;; ++i) {
-		if (i == 5 * 2000) {
+UhdaStatus UhdaController::send_immediate(VerbDescriptor verb, ResponseDescriptor& res) {
+	Deadline deadline {VERB_TIMEOUT_US};
+	while (space.load(regs::ICIS) & icis::ICB) {
+		if (deadline.expired()) {
 			return UHDA_STATUS_TIMEOUT;
 		}
+		deadline.poll();
+	}
+
+	space.store(regs::ICOI, verb.value);
+	// clear the result of the previous verb and send the new one
+	space.store(regs::ICIS, icis::IRV(true) | icis::ICB(true));
 
-		if ((space.load(regs::CORBWP) & corbwp::WP) == index) {
+	while (true) {
+		auto sts = space.load(regs::ICIS);
+		if ((sts & icis::IRV) && !(sts & icis::ICB)) {
 			break;
 		}
+		if (deadline.expired()) {
+			return UHDA_STATUS_TIMEOUT;
+		}
+		deadline.poll();
 	}
 
-	for (int i = 0;; ++i) {
-		if (i == 5 * 2000) {
+	res.resp = space.load(regs::ICII);
+	res.resp_ex = verb.value >> 28;
+	return UHDA_STATUS_SUCCESS;
+}
+
+UhdaStatus UhdaController::set_rings_running(bool run) {
+	auto corbctl = space.load(regs::CORBCTL);
+	corbctl &= ~corbctl::RUN;
+	corbctl |= corbctl::RUN(run);
+	space.store(regs::CORBCTL, corbctl);
+	auto rirbctl = space.load(regs::RIRBCTL);
+	rirbctl &= ~rirbctl::DMAEN;
+	rirbctl |= rirbctl::DMAEN(run);
+	space.store(regs::RIRBCTL, rirbctl);
+
+	// the dma engines report the new state once they have actually started/stopped
+	Deadline deadline {VERB_TIMEOUT_US};
+	while (static_cast<bool>(space.load(regs::CORBCTL) & corbctl::RUN) != run ||
+		static_cast<bool>(space.load(regs::RIRBCTL) & rirbctl::DMAEN) != run) {
+		if (deadline.expired()) {
 			return UHDA_STATUS_TIMEOUT;
 		}
+		deadline.poll();
+	}
 
-		if ((space.load(regs::RIRBWP) & rirbwp::WP) == index) {
-			break;
+	return UHDA_STATUS_SUCCESS;
+}
+
+UhdaStatus UhdaController::set_verb_transport(UhdaVerbTransport transport) {
+	{
+		LockGuard guard {lock};
+		if (transport == verb_transport) {
+			return UHDA_STATUS_SUCCESS;
+		}
+
+		// before the link is up the transport is only applied once the rings would be started
+		if (resume_state == ResumeState::DONE) {
+			bool rings = transport == UHDA_VERB_TRANSPORT_RINGS;
+			if (!rings) {
+				// record the unsolicited responses that are still in the rirb
+				drain_rirb();
+				unsol_enabled = false;
+			}
+
+			auto status = set_rings_running(rings);
+			if (status != UHDA_STATUS_SUCCESS) {
+				return status;
+			}
+
+			if (rings) {
+				enable_unsol_irq();
+			}
+		}
+
+		verb_transport = transport;
+	}
+
+	// plug events are missed without the rings, so a presence cached before or while not using them
+	// can't be used once they run again
+	for (auto codec : codecs) {
+		LockGuard guard {codec->lock};
+		for (auto output : codec->unsol_outputs) {
+			output->presence_valid = false;
+		}
+	}
+
+	return UHDA_STATUS_SUCCESS;
+}
+
+UhdaStatus UhdaController::wait_for_responses(const UhdaCodec* codec, uhda::ResponseDescriptor* res, uint8_t count) {
+	// the caller holds the codec lock so this can only spin
+	Deadline deadline {VERB_TIMEOUT_US};
+	uint8_t received = 0;
+	for (uint32_t polls = 1;; ++polls, deadline.poll()) {
+		bool expired = deadline.expired();
+
+		LockGuard guard {lock};
+		// the responses are watched for in memory, the write pointer register is only read
+		// once in a while and before giving up in case an entry was missed
+		if (expired || polls % RIRB_CONFIRM_INTERVAL == 0) {
+			drain_rirb();
+		}
+		else {
+			poll_rirb();
+		}
+
+		while (received < count && codec->response_tail != codec->response_head) {
+			res[received++] = codec->responses[codec->response_tail++ % UhdaCodec::RESPONSE_QUEUE_SIZE];
+		}
+
+		if (received == count) {
+			return UHDA_STATUS_SUCCESS;
+		}
+		else if (expired) {
+			return UHDA_STATUS_TIMEOUT;
+		}
+	}
+}
+
+UhdaStatus UhdaController::update_presence(UhdaOutput* const* outputs, size_t count, bool* presence) {
+	// outputs handled per batch, each needs at most a pin sense trigger and a read
+	static constexpr uint8_t BATCH_OUTPUTS = 32;
+
+	VerbDescriptor verbs[BATCH_OUTPUTS * 2];
+	ResponseDescriptor responses[BATCH_OUTPUTS * 2];
+
+	uint8_t max_outputs = corb_size / 2 - 1;
+	if (max_outputs > BATCH_OUTPUTS) {
+		max_outputs = BATCH_OUTPUTS;
+	}
+	else if (!max_outputs) {
+		max_outputs = 1;
+	}
+
+	// a batch only contains outputs of one codec as responses are waited for per codec
+	for (size_t start = 0; start < count;) {
+		auto codec = outputs[start]->widget->codec;
+
+		size_t end = start + 1;
+		while (end < count && end - start < max_outputs && outputs[end]->widget->codec == codec) {
+			++end;
+		}
+
+		uint8_t verb_count = 0;
+		for (size_t i = start; i < end; ++i) {
+			auto widget = outputs[i]->widget;
+			if (!widget->presence_detect) {
+				continue;
+			}
+
+			codec->clear_unsol(outputs[i]);
+
+			if (widget->trigger) {
+				verbs[verb_count++] = VerbDescriptor::make(codec->cid, widget->nid, cmd::SET_PIN_SENSE, 0);
+			}
+			verbs[verb_count++] = VerbDescriptor::make(codec->cid, widget->nid, cmd::GET_PIN_SENSE, 0);
+		}
+
+		if (verb_count) {
+			LockGuard guard {codec->lock};
+			// a corb with only two entries can't take more than one verb at a time
+			uint8_t batch_size = corb_size > 2 ? verb_count : 1;
+			for (uint8_t i = 0; i < verb_count; i += batch_size) {
+				auto status = codec->send_verbs(&verbs[i], batch_size, &responses[i]);
+				if (status != UHDA_STATUS_SUCCESS) {
+					return status;
+				}
+			}
+		}
+
+		uint8_t resp_i = 0;
+		for (size_t i = start; i < end; ++i) {
+			auto output = outputs[i];
+			auto widget = output->widget;
+			if (!widget->presence_detect) {
+				presence[i] = false;
+				continue;
+			}
+
+			if (widget->trigger) {
+				++resp_i;
+			}
+			presence[i] = responses[resp_i++].resp & 1 << 31;
+			codec->report_presence(output, presence[i]);
+		}
+
+		start = end;
+	}
+
+	return UHDA_STATUS_SUCCESS;
+}
+
+void UhdaController::drain_rirb() {
+	uint8_t wp = space.load(regs::RIRBWP) & rirbwp::WP;
+	while (rirb_rp != wp) {
+		consume_response();
+	}
+}
+
+void UhdaController::poll_rirb() {
+	auto entries = const_cast<volatile ResponseDescriptor*>(rirb);
+	while (entries[(rirb_rp + 1) % rirb_size].resp_ex != RIRB_EMPTY) {
+		consume_response();
+	}
+}
+
+void UhdaController::consume_response() {
+	rirb_rp = (rirb_rp + 1) % rirb_size;
+
+	auto& entry = const_cast<volatile ResponseDescriptor&>(rirb[rirb_rp]);
+	ResponseDescriptor resp {
+		.resp = entry.resp,
+		.resp_ex = entry.resp_ex
+	};
+	// mark the entry as consumed so that it isn't seen as new when polling after the rirb wraps around
+	entry.resp_ex = RIRB_EMPTY;
+
+	if (resp.is_unsol()) {
+		mark_unsol(resp);
+		return;
+	}
+
+	auto codec = codec_slots[resp.get_codec()];
+	if (!codec) {
+		return;
+	}
+
+	if (static_cast<uint8_t>(codec->response_head - codec->response_tail) == UhdaCodec::RESPONSE_QUEUE_SIZE) {
+		uhda_kernel_log("warning: codec response queue is full, dropping response");
+		return;
+	}
+	codec->responses[codec->response_head++ % UhdaCodec::RESPONSE_QUEUE_SIZE] = resp;
+}
+
+void UhdaController::mark_unsol(const uhda::ResponseDescriptor& resp) {
+	auto codec = codec_slots[resp.get_codec()];
+	uint8_t tag = resp.resp >> 26;
+	if (!codec || !tag || tag > codec->unsol_outputs.size()) {
+		return;
+	}
+
+	codec->unsol_pending |= uint64_t {1} << tag;
+}
+
+UhdaStatus UhdaController::poll_presence() {
+	for (auto codec : codecs) {
+		uint64_t pending;
+		{
+			LockGuard guard {lock};
+			pending = codec->unsol_pending;
+		}
+		if (!pending) {
+			continue;
+		}
+
+		UhdaOutput* outputs[0x3F];
+		bool presence[0x3F];
+		size_t count = 0;
+		for (size_t i = 0; i < codec->unsol_outputs.size(); ++i) {
+			if (pending & uint64_t {1} << (i + 1)) {
+				outputs[count++] = codec->unsol_outputs[i];
+			}
+		}
+
+		auto status = update_presence(outputs, count, presence);
+		if (status != UHDA_STATUS_SUCCESS) {
+			return status;
 		}
 	}
 
-	res = rirb[index];
 	return UHDA_STATUS_SUCCESS;
 }
 
@@ -468,7 +982,86 @@ UhdaStatus UhdaController::pci_setup() {
 		return status;
 	}
 
-	return UHDA_STATUS_SUCCESS;
+	uint32_t vendor_id;
+	status = uhda_kernel_pci_read(pci_device, 0, 2, &vendor_id);
+	if (status != UHDA_STATUS_SUCCESS) {
+		return status;
+	}
+	pci_vendor_id = vendor_id;
+
+	return setup_snoop();
+}
+
+UhdaStatus UhdaController::setup_snoop() {
+	UhdaStatus status = UHDA_STATUS_SUCCESS;
+	if (pci_vendor_id != PCI_VENDOR_ATI && pci_vendor_id != PCI_VENDOR_AMD && pci_vendor_id != PCI_VENDOR_NVIDIA) {
+		status = pci_update(pci_device, pci_reg::TCSEL, 1, 0b111, 0);
+		if (status != UHDA_STATUS_SUCCESS) {
+			return status;
+		}
+	}
+
+	// the firmware setting is kept for uncached buffers, which are coherent either way
+	if (buffer_map_type == UHDA_MAP_TYPE_UNCACHEABLE) {
+		return UHDA_STATUS_SUCCESS;
+	}
+
+	// cached buffers need snooping, write-combined ones are faster without it
+	bool snoop = buffer_map_type == UHDA_MAP_TYPE_CACHEABLE;
+
+	switch (pci_vendor_id) {
+		case PCI_VENDOR_INTEL:
+			status = pci_update(
+				pci_device,
+				pci_reg::INTEL_DEVC,
+				2,
+				pci_reg::INTEL_DEVC_NOSNOOP,
+				snoop ? 0 : pci_reg::INTEL_DEVC_NOSNOOP);
+			break;
+		case PCI_VENDOR_ATI:
+		case PCI_VENDOR_AMD:
+			status = pci_update(
+				pci_device,
+				pci_reg::ATI_MISC_CNTR2,
+				1,
+				pci_reg::ATI_ENABLE_SNOOP,
+				snoop ? pci_reg::ATI_ENABLE_SNOOP : 0);
+			break;
+		case PCI_VENDOR_NVIDIA:
+		{
+			uint8_t cohbit = snoop ? pci_reg::NVIDIA_ENABLE_COHBIT : 0;
+			status = pci_update(
+				pci_device,
+				pci_reg::NVIDIA_TRANSREG,
+				1,
+				pci_reg::NVIDIA_ENABLE_COHBITS,
+				snoop ? pci_reg::NVIDIA_ENABLE_COHBITS : 0);
+			if (status == UHDA_STATUS_SUCCESS) {
+				status = pci_update(pci_device, pci_reg::NVIDIA_ISTRM_COH, 1, pci_reg::NVIDIA_ENABLE_COHBIT, cohbit);
+			}
+			if (status == UHDA_STATUS_SUCCESS) {
+				status = pci_update(pci_device, pci_reg::NVIDIA_OSTRM_COH, 1, pci_reg::NVIDIA_ENABLE_COHBIT, cohbit);
+			}
+			break;
+		}
+		default:
+			// the snoop control of other controllers isn't known, cached buffers then rely on cache flushes
+			break;
+	}
+
+	return status;
+}
+
+UhdaStatus UhdaController::set_buffer_map_type(UhdaMapType type) {
+#ifndef UHDA_KERNEL_HAS_MAP_TYPE
+	if (type != UHDA_MAP_TYPE_UNCACHEABLE) {
+		return UHDA_STATUS_UNSUPPORTED;
+	}
+#endif
+
+	LockGuard guard {lock};
+	buffer_map_type = type;
+	return setup_snoop();
 }
 
 UhdaStatus UhdaController::map_bar() {
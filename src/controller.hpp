@@ -5,6 +5,9 @@
 #include "stream.hpp"
 #include "vector.hpp"
 #include "codec.hpp"
+#include "dma_cache.hpp"
+#include "param_cache.hpp"
+#include "wait.hpp"
 
 struct UhdaController {
 	constexpr explicit UhdaController(void* pci_device) : pci_device {pci_device} {}
@@ -14,17 +17,92 @@ struct UhdaController {
 	UhdaStatus init();
 	UhdaStatus destroy();
 
+	/*
+	 * Sets up everything that doesn't need waiting, the rest of the initialization is done by `poll_init`.
+	 */
+	UhdaStatus init_async(UhdaInitFn fn, void* arg);
+	/*
+	 * Advances the asynchronous initialization, returns false once it's finished.
+	 */
+	bool poll_init(uint32_t& delay_us);
+
 	UhdaStatus suspend();
 	UhdaStatus resume();
 
-	uint8_t submit_verb(uint8_t cid, uint8_t nid, uint16_t cmd, uint8_t data);
-	uint8_t submit_verb_long(uint8_t cid, uint8_t nid, uint8_t cmd, uint16_t data);
-	UhdaStatus wait_for_verb(uint8_t index, uhda::ResponseDescriptor& res);
+	enum class ResumeState : uint8_t {
+		// stop the dma engines and put the controller into reset
+		ENTER_RESET,
+		WAIT_RESET,
+		LEAVE_RESET,
+		// wait for the link to come out of reset and set up the rings and streams
+		WAIT_LINK,
+		// the codecs have had time to request a state change
+		ENUMERATE_START,
+		// one codec per step
+		ENUMERATE,
+		DONE,
+		FAILED
+	};
+
+	/*
+	 * Runs the resume state machine until it has to wait or is done,
+	 * `delay_us` is set to the time to wait before the next step.
+	 */
+	UhdaStatus resume_step(bool& done, uint32_t& delay_us);
+
+	/*
+	 * Submits multiple verbs with a single write pointer update, `count` must be smaller than the corb.
+	 * Waits for the controller to fetch earlier verbs if the corb doesn't have enough free entries.
+	 * Must be called with the lock held.
+	 */
+	UhdaStatus submit_verbs(const uhda::VerbDescriptor* verbs, uint8_t count);
+	/*
+	 * Waits for `count` responses from the codec in submission order,
+	 * the lock is only taken while reading the rirb.
+	 */
+	UhdaStatus wait_for_responses(const UhdaCodec* codec, uhda::ResponseDescriptor* res, uint8_t count);
+
+	/*
+	 * Sends a single verb using the immediate command registers, must be called with the lock held.
+	 */
+	UhdaStatus send_immediate(uhda::VerbDescriptor verb, uhda::ResponseDescriptor& res);
+	UhdaStatus set_verb_transport(UhdaVerbTransport transport);
+	UhdaStatus set_buffer_map_type(UhdaMapType type);
+	// starts or stops the corb and rirb dma, must be called with the lock held
+	UhdaStatus set_rings_running(bool run);
+
+	/*
+	 * Reads the presence of multiple outputs using batches of verbs and updates their cached values,
+	 * outputs without presence detection are reported as not present.
+	 */
+	UhdaStatus update_presence(UhdaOutput* const* outputs, size_t count, bool* presence);
+	/*
+	 * Reads the presence of the outputs that sent unsolicited responses since it was last read.
+	 */
+	UhdaStatus poll_presence();
 
+	// all of these must be called with the lock held
+	// reads the responses up to the rirb write pointer register
+	void drain_rirb();
+	// reads the responses that the controller has written to memory without touching the registers
+	void poll_rirb();
+	void consume_response();
+	// marks the output that sent an unsolicited response as having to have its presence read again
+	void mark_unsol(const uhda::ResponseDescriptor& resp);
+
+	UhdaStatus init_resources();
 	UhdaStatus pci_setup();
+	// programs the traffic class and the vendor specific snoop control to match `buffer_map_type`
+	UhdaStatus setup_snoop();
 	UhdaStatus map_bar();
+	// stops the dma engines and clears CRST, returns false if the controller was already in reset
+	bool enter_reset();
+	UhdaStatus setup_link();
+	UhdaStatus enumerate_codec(uint8_t cid);
+	void enable_unsol_irq();
 
 	void* pci_device;
+	uint16_t pci_vendor_id {};
 	void* irq {};
 	uhda::MemSpace space {0};
 	uint32_t bar {};
@@ -41,8 +119,34 @@ struct UhdaController {
 	UhdaStream* in_stream_ptrs[16] {};
 	UhdaStream* out_stream_ptrs[16] {};
 	uhda::vector<UhdaCodec*> codecs;
+	// indexed by codec address, used for routing responses
+	UhdaCodec* codec_slots[16] {};
+	// indexed by codec address, kept across suspend/resume
+	uhda::ParamCache param_caches[15] {};
 	uint8_t in_stream_count {};
 	uint8_t out_stream_count {};
+	uhda::DmaCache dma_cache {};
+
+	// stored in the extended response of consumed rirb entries, the controller never sets the reserved bits
+	static constexpr uint32_t RIRB_EMPTY = 0xFFFFFFFF;
+	// memory polls between reads of the rirb write pointer register while waiting for responses
+	static constexpr uint32_t RIRB_CONFIRM_INTERVAL = 64;
+
+	uint16_t rirb_rp {};
+	bool unsol_enabled {};
+	UhdaVerbTransport verb_transport {UHDA_VERB_TRANSPORT_RINGS};
+#ifdef UHDA_KERNEL_HAS_MAP_TYPE
+	UhdaMapType buffer_map_type {UHDA_MAP_TYPE_WRITE_COMBINING};
+#else
+	UhdaMapType buffer_map_type {UHDA_MAP_TYPE_UNCACHEABLE};
+#endif
+
+	ResumeState resume_state {ResumeState::DONE};
+	uhda::Deadline resume_deadline {};
+	// codec addresses from STATESTS that haven't been enumerated yet
+	uint16_t pending_codecs {};
+	UhdaInitFn init_fn {};
+	void* init_arg {};
 
 	void* lock {};
 };
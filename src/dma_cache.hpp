@@ -0,0 +1,133 @@
+#pragma once
+#include "uhda/kernel_api.h"
+#include "spec.hpp"
+
+namespace uhda {
+	/*
+	 * How the buffer of a stream is split into periods and chunks.
+	 */
+	struct DmaLayout {
+		uint32_t period_count;
+		uint32_t period_size;
+		// the size of the chunks, periods larger than this span multiple chunks
+		uint32_t chunk_size;
+		bool contiguous;
+		// how the contiguous buffer is mapped, scatter chunks are mapped by the kernel
+		UhdaMapType map_type;
+
+		[[nodiscard]] constexpr uint32_t chunks_per_period() const {
+			return (period_size + chunk_size - 1) / chunk_size;
+		}
+
+		[[nodiscard]] constexpr uint32_t chunk_count() const {
+			return period_count * chunks_per_period();
+		}
+
+		[[nodiscard]] constexpr uint32_t buffer_size() const {
+			return period_count * period_size;
+		}
+
+		constexpr bool operator==(const DmaLayout& other) const = default;
+	};
+
+	/*
+	 * The dma memory of a stream, any of the parts may be missing if the setup failed.
+	 * Contiguous buffers are one allocation that the chunks point into.
+	 */
+	struct DmaBuffers {
+		uintptr_t bdl_phys;
+		BufferDescriptor* bdl;
+		UhdaScatterChunk* chunks;
+		DmaLayout layout;
+		uintptr_t buffer_phys;
+		void* buffer;
+		// the chunks were allocated using `uhda_kernel_allocate_scatter`
+		bool scattered;
+
+		[[nodiscard]] bool is_complete() const {
+			return bdl && chunks && (scattered || buffer);
+		}
+
+		/*
+		 * Frees all parts of the buffers, must not be called with a spinlock held.
+		 */
+		void free() {
+			if (chunks) {
+				if (scattered) {
+					uhda_kernel_deallocate_scatter(chunks, layout.chunk_count(), layout.chunk_size);
+				}
+				uhda_kernel_free(chunks, layout.chunk_count() * sizeof(UhdaScatterChunk));
+			}
+			if (buffer) {
+				uhda_kernel_unmap(buffer, layout.buffer_size());
+			}
+			if (buffer_phys) {
+				uhda_kernel_deallocate_physical(buffer_phys, layout.buffer_size());
+			}
+			if (bdl) {
+				uhda_kernel_unmap(bdl, 0x1000);
+			}
+			if (bdl_phys) {
+				uhda_kernel_deallocate_physical(bdl_phys, 0x1000);
+			}
+			*this = {};
+		}
+	};
+
+	/*
+	 * Dma buffers of streams that were shut down, reused by streams set up later with the same
+	 * layout so restarting a stream doesn't allocate or map anything.
+	 * The cache is not synchronized, the controller lock protects it.
+	 */
+	class DmaCache {
+	public:
+		constexpr DmaCache() = default;
+
+		DmaCache(const DmaCache&) = delete;
+		DmaCache& operator=(const DmaCache&) = delete;
+
+		~DmaCache() {
+			clear();
+		}
+
+		[[nodiscard]] bool take(const DmaLayout& layout, DmaBuffers& res) {
+			for (size_t i = 0; i < count; ++i) {
+				if (entries[i].layout == layout) {
+					res = entries[i];
+					entries[i] = entries[--count];
+					entries[count] = {};
+					return true;
+				}
+			}
+			return false;
+		}
+
+		/*
+		 * Stores the buffers in the cache, returns false if they are incomplete or the cache is full
+		 * in which case the caller has to free them.
+		 */
+		[[nodiscard]] bool put(const DmaBuffers& buffers) {
+			if (!buffers.is_complete() || count == SIZE) {
+				return false;
+			}
+			entries[count++] = buffers;
+			return true;
+		}
+
+		/*
+		 * Frees all cached buffers, must not be called with a spinlock held.
+		 */
+		void clear() {
+			for (size_t i = 0; i < count; ++i) {
+				entries[i].free();
+			}
+			count = 0;
+		}
+
+	private:
+		static constexpr size_t SIZE = 4;
+
+		DmaBuffers entries[SIZE] {};
+		size_t count {};
+	};
+}
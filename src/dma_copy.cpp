@@ -0,0 +1,139 @@
+#include "dma_copy.hpp"
+#include <stdint.h>
+
+#if defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#define memcpy __builtin_memcpy
+#define memset __builtin_memset
+
+namespace {
+	void generic_copy(void* dst, const void* src, size_t size) {
+		memcpy(dst, src, size);
+	}
+
+	void generic_zero(void* dst, size_t size) {
+		memset(dst, 0, size);
+	}
+
+#if defined(__x86_64__) || defined(__i386__)
+	/*
+	 * Non-temporal stores from general purpose registers, they need sse2 but don't touch the vector
+	 * registers which kernels usually don't save for driver code.
+	 */
+	using Word = unsigned long;
+
+	constexpr size_t LINE_WORDS = 64 / sizeof(Word);
+
+	inline void store_nt(Word* dst, Word value) {
+		asm volatile("movnti %1, %0" : "=m"(*dst) : "r"(value));
+	}
+
+	inline bool line_aligned(const Word* dst) {
+		return reinterpret_cast<uintptr_t>(dst) % 64 == 0;
+	}
+
+	inline void store_fence() {
+		asm volatile("sfence" : : : "memory");
+	}
+
+	// stores bytes up to the next word boundary of `dst` and returns the remaining size
+	inline size_t align_head(char*& dst, const char*& src, size_t size) {
+		while (size && reinterpret_cast<uintptr_t>(dst) % sizeof(Word)) {
+			*dst++ = src ? *src++ : 0;
+			--size;
+		}
+		return size;
+	}
+
+	void nt_copy(void* dst, const void* src, size_t size) {
+		auto* d = static_cast<char*>(dst);
+		auto* s = static_cast<const char*>(src);
+		size = align_head(d, s, size);
+
+		auto* words = reinterpret_cast<Word*>(d);
+		for (; size >= sizeof(Word) && !line_aligned(words); size -= sizeof(Word)) {
+			Word value;
+			memcpy(&value, s, sizeof(Word));
+			store_nt(words++, value);
+			s += sizeof(Word);
+		}
+
+		// whole cache lines are written back to back so that write-combining buffers are flushed as full bursts
+		for (; size >= LINE_WORDS * sizeof(Word); size -= LINE_WORDS * sizeof(Word)) {
+			for (size_t i = 0; i < LINE_WORDS; ++i) {
+				Word value;
+				memcpy(&value, s, sizeof(Word));
+				store_nt(words++, value);
+				s += sizeof(Word);
+			}
+		}
+		for (; size >= sizeof(Word); size -= sizeof(Word)) {
+			Word value;
+			memcpy(&value, s, sizeof(Word));
+			store_nt(words++, value);
+			s += sizeof(Word);
+		}
+
+		d = reinterpret_cast<char*>(words);
+		memcpy(d, s, size);
+		store_fence();
+	}
+
+	void nt_zero(void* dst, size_t size) {
+		auto* d = static_cast<char*>(dst);
+		const char* s = nullptr;
+		size = align_head(d, s, size);
+
+		auto* words = reinterpret_cast<Word*>(d);
+		for (; size >= sizeof(Word) && !line_aligned(words); size -= sizeof(Word)) {
+			store_nt(words++, 0);
+		}
+
+		for (; size >= LINE_WORDS * sizeof(Word); size -= LINE_WORDS * sizeof(Word)) {
+			for (size_t i = 0; i < LINE_WORDS; ++i) {
+				store_nt(words++, 0);
+			}
+		}
+		for (; size >= sizeof(Word); size -= sizeof(Word)) {
+			store_nt(words++, 0);
+		}
+
+		d = reinterpret_cast<char*>(words);
+		memset(d, 0, size);
+		store_fence();
+	}
+
+	bool has_nt_stores() {
+#if defined(__x86_64__)
+		// sse2 is part of the base x86_64 instruction set
+		return true;
+#else
+		unsigned int eax;
+		unsigned int ebx;
+		unsigned int ecx;
+		unsigned int edx;
+		return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (edx & bit_SSE2);
+#endif
+	}
+#endif
+}
+
+namespace uhda {
+	DmaCopyOps dma_copy_ops {
+		.copy = generic_copy,
+		.zero = generic_zero
+	};
+
+	void select_dma_copy() {
+#if defined(__x86_64__) || defined(__i386__)
+		if (has_nt_stores()) {
+			dma_copy_ops = {
+				.copy = nt_copy,
+				.zero = nt_zero
+			};
+		}
+#endif
+	}
+}
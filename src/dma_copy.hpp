@@ -0,0 +1,29 @@
+#pragma once
+#include <stddef.h>
+
+namespace uhda {
+	/*
+	 * Routines for writing memory that is read by the controller. They never read the destination
+	 * and keep the data out of the cpu caches where the cpu allows it, which is much faster for
+	 * uncached or write-combined mappings. Non-temporal stores are fenced before returning.
+	 */
+	struct DmaCopyOps {
+		void (*copy)(void* dst, const void* src, size_t size);
+		void (*zero)(void* dst, size_t size);
+	};
+
+	extern DmaCopyOps dma_copy_ops;
+
+	/*
+	 * Selects the routines for the current cpu, only needs to be called once but calling it again is harmless.
+	 */
+	void select_dma_copy();
+
+	inline void dma_copy(void* dst, const void* src, size_t size) {
+		dma_copy_ops.copy(dst, src, size);
+	}
+
+	inline void dma_zero(void* dst, size_t size) {
+		dma_copy_ops.zero(dst, size);
+	}
+}
@@ -0,0 +1,143 @@
+#pragma once
+#include "lock_guard.hpp"
+#include "vector.hpp"
+
+namespace uhda {
+	/*
+	 * Responses to read-only codec parameters keyed by nid and parameter.
+	 * The cache outlives codec re-enumeration and is only valid as long as
+	 * the codec at the address reports the same vendor and revision ids.
+	 */
+	class ParamCache {
+	public:
+		// key used for the configuration default, which is read using its own verb
+		static constexpr uint16_t CONFIG_DEFAULT = 0x100;
+
+		constexpr ParamCache() = default;
+
+		[[nodiscard]] bool matches(uint32_t new_vendor_id, uint32_t new_revision_id) const {
+			return valid && vendor_id == new_vendor_id && revision_id == new_revision_id;
+		}
+
+		/*
+		 * Drops all entries and binds the cache to a codec.
+		 */
+		void reset(uint32_t new_vendor_id, uint32_t new_revision_id) {
+			for (auto& entry : entries) {
+				entry = {};
+			}
+			count = 0;
+			vendor_id = new_vendor_id;
+			revision_id = new_revision_id;
+			valid = true;
+		}
+
+		[[nodiscard]] bool get(uint8_t nid, uint16_t param, uint32_t& res) const {
+			if (entries.is_empty()) {
+				return false;
+			}
+
+			auto key = make_key(nid, param);
+			size_t mask = entries.size() - 1;
+			for (size_t i = hash(key) & mask;; i = (i + 1) & mask) {
+				auto& entry = entries[i];
+				if (entry.key == key) {
+					res = entry.value;
+					return true;
+				}
+				else if (!entry.key) {
+					return false;
+				}
+			}
+		}
+
+		/*
+		 * Inserts or replaces an entry, the cache is best-effort so an entry that doesn't fit
+		 * just isn't cached. Nothing is allocated here as the codec lock is held, see `reserve`.
+		 */
+		void insert(uint8_t nid, uint16_t param, uint32_t value) {
+			if ((count + 1) * 4 > entries.size() * 3) {
+				return;
+			}
+
+			if (place(make_key(nid, param), value)) {
+				++count;
+			}
+		}
+
+		/*
+		 * Grows the cache to fit `new_count` entries, the table is allocated without holding `lock`
+		 * and only swapped in while holding it. Returns false if the allocation failed.
+		 *
+		 * Note: must not be called with a spinlock held.
+		 */
+		bool reserve(size_t new_count, void* lock) {
+			size_t new_size = entries.is_empty() ? MIN_ENTRIES : entries.size();
+			while (new_count * 4 > new_size * 3) {
+				new_size *= 2;
+			}
+			if (new_size == entries.size()) {
+				return true;
+			}
+
+			vector<Entry> new_entries;
+			if (!new_entries.resize(new_size)) {
+				return false;
+			}
+
+			vector<Entry> old;
+			{
+				LockGuard guard {lock};
+				old = move(entries);
+				entries = move(new_entries);
+
+				for (auto& entry : old) {
+					if (entry.key) {
+						place(entry.key, entry.value);
+					}
+				}
+			}
+
+			// the old table is freed here, after the lock is released
+			return true;
+		}
+
+	private:
+		static constexpr size_t MIN_ENTRIES = 512;
+
+		struct Entry {
+			uint32_t key;
+			uint32_t value;
+		};
+
+		static constexpr uint32_t make_key(uint8_t nid, uint16_t param) {
+			return 1U << 31 | static_cast<uint32_t>(nid) << 16 | param;
+		}
+
+		static constexpr size_t hash(uint32_t key) {
+			return (key * 0x9E3779B1U) >> 16;
+		}
+
+		// returns whether a new entry was added
+		bool place(uint32_t key, uint32_t value) {
+			size_t mask = entries.size() - 1;
+			for (size_t i = hash(key) & mask;; i = (i + 1) & mask) {
+				auto& entry = entries[i];
+				if (entry.key == key) {
+					entry.value = value;
+					return false;
+				}
+				else if (!entry.key) {
+					entry = {.key = key, .value = value};
+					return true;
+				}
+			}
+		}
+
+		vector<Entry> entries;
+		size_t count {};
+		uint32_t vendor_id {};
+		uint32_t revision_id {};
+		bool valid {};
+	};
+}
@@ -1,8 +1,16 @@
 #include "uhda/simple.h"
 #include "uhda/kernel_api.h"
+#include "controller.hpp"
+#include "dma_copy.hpp"
 #include "lock_guard.hpp"
 
 static constexpr uint32_t ALLOWED_SOFTWARE_AHEAD = 0x1000 * 4;
+// the size of the block on the stack used when mixing multiple streams, a multiple of every sample size
+static constexpr uint32_t MIX_BLOCK_SIZE = 512;
+// the size of the block on the stack used to interleave planar data, fits a frame of 16 32-bit channels
+static constexpr uint32_t INTERLEAVE_BLOCK_SIZE = 512;
+static constexpr uint32_t SIMPLE_PERIOD_COUNT = 256;
+static constexpr uint32_t SIMPLE_PERIOD_SIZE = 0x1000;
 
 #define UHDA_MIN(a, b) ((a) < (b) ? (a) : (b))
 
@@ -11,6 +19,109 @@ static constexpr uint32_t ALLOWED_SOFTWARE_AHEAD = 0x1000 * 4;
 
 using namespace uhda;
 
+namespace {
+	// the size of a sample in the buffer
+	uint32_t sample_size(UhdaFormat fmt) {
+		switch (fmt) {
+			case UHDA_FORMAT_PCM8:
+				return 1;
+			case UHDA_FORMAT_PCM16:
+				return 2;
+			// 20 and 24-bit samples are stored in the high bits of 32-bit containers
+			case UHDA_FORMAT_PCM20:
+			case UHDA_FORMAT_PCM24:
+			case UHDA_FORMAT_PCM32:
+				return 4;
+		}
+		return 0;
+	}
+
+	// the size of a sample in the buffer if the format can be mixed, 0 otherwise
+	uint32_t mix_sample_size(UhdaFormat fmt) {
+		auto size = sample_size(fmt);
+		return size >= 2 ? size : 0;
+	}
+
+	// adds the samples in `src` to the ones in `dst` saturating on overflow
+	void mix_samples(char* dst, const char* src, uint32_t size, uint32_t sample_size) {
+		if (sample_size == 2) {
+			for (uint32_t i = 0; i < size; i += 2) {
+				int16_t a;
+				int16_t b;
+				memcpy(&a, dst + i, 2);
+				memcpy(&b, src + i, 2);
+				int32_t sum = a + b;
+				auto value = static_cast<int16_t>(sum > INT16_MAX ? INT16_MAX : sum < INT16_MIN ? INT16_MIN : sum);
+				memcpy(dst + i, &value, 2);
+			}
+		}
+		else {
+			for (uint32_t i = 0; i < size; i += 4) {
+				int32_t a;
+				int32_t b;
+				memcpy(&a, dst + i, 4);
+				memcpy(&b, src + i, 4);
+				int64_t sum = static_cast<int64_t>(a) + b;
+				auto value = static_cast<int32_t>(sum > INT32_MAX ? INT32_MAX : sum < INT32_MIN ? INT32_MIN : sum);
+				memcpy(dst + i, &value, 4);
+			}
+		}
+	}
+}
+
+/*
+ * A fifo of client-owned buffers linked through their `next` field.
+ */
+struct BufferQueue {
+	UhdaSimpleBuffer* head;
+	UhdaSimpleBuffer* tail;
+
+	void push(UhdaSimpleBuffer* buffer) {
+		buffer->next = nullptr;
+		if (tail) {
+			tail->next = buffer;
+		}
+		else {
+			head = buffer;
+		}
+		tail = buffer;
+	}
+
+	UhdaSimpleBuffer* pop() {
+		auto buffer = head;
+		head = buffer->next;
+		if (!head) {
+			tail = nullptr;
+		}
+		return buffer;
+	}
+
+	void append(BufferQueue& other) {
+		if (!other.head) {
+			return;
+		}
+		if (tail) {
+			tail->next = other.head;
+		}
+		else {
+			head = other.head;
+		}
+		tail = other.tail;
+		other = {};
+	}
+
+	/*
+	 * Calls the callbacks of all buffers in the queue and empties it, must not be called with the lock held.
+	 */
+	void complete(bool played) {
+		while (head) {
+			// the buffer may be reused by the callback
+			auto buffer = pop();
+			buffer->fn(buffer, played, buffer->arg);
+		}
+	}
+};
+
 struct RingBuffer {
 	char* ptr;
 	uint32_t read_pos;
@@ -38,13 +149,15 @@ struct RingBuffer {
 		}
 	}
 
-	void read(void* data, uint32_t to_read) {
-		auto* data_ptr = static_cast<char*>(data);
-
+	/*
+	 * Removes `to_read` bytes from the ring, `fn` is called with the offset and the parts of the data.
+	 */
+	template<typename F>
+	void consume(uint32_t to_read, F fn) {
 		uint32_t i = 0;
 		while (i < to_read) {
 			uint32_t chunk = UHDA_MIN(to_read - i, capacity - read_pos);
-			memcpy(data_ptr + i, ptr + read_pos, chunk);
+			fn(i, ptr + read_pos, chunk);
 
 			read_pos += chunk;
 			if (read_pos == capacity) {
@@ -57,6 +170,32 @@ struct RingBuffer {
 		size -= to_read;
 	}
 
+	/*
+	 * Adds up to `to_write` bytes to the ring, `fn` is called with the parts of the free space
+	 * and returns how much it has written to them. Returns the total written.
+	 */
+	template<typename F>
+	uint32_t produce(uint32_t to_write, F fn) {
+		uint32_t i = 0;
+		while (i < to_write) {
+			uint32_t chunk = UHDA_MIN(to_write - i, capacity - write_pos);
+			uint32_t written = UHDA_MIN(fn(ptr + write_pos, chunk), chunk);
+
+			write_pos += written;
+			if (write_pos == capacity) {
+				write_pos = 0;
+			}
+
+			i += written;
+			size += written;
+			if (written != chunk) {
+				break;
+			}
+		}
+
+		return i;
+	}
+
 	void write(const void* data, uint32_t to_write) {
 		auto* data_ptr = static_cast<const char*>(data);
 
@@ -83,14 +222,35 @@ struct RingBuffer {
 	}
 };
 
-struct UhdaSimpleStream {
+/*
+ * The state of a base stream shared by the simple streams played through it,
+ * each simple stream has its own ring buffer and they are mixed together when filling the periods.
+ */
+struct SharedStream {
 	UhdaStream* base;
 	UhdaStreamParams params;
-	RingBuffer buffer;
 	void* lock;
 	uint32_t prev_irq_pos;
 	uint32_t current_fill_pos;
 	const UhdaScatterChunk* chunks;
+	// the whole dma buffer if it's contiguous, the ring is then copied in segments spanning multiple periods
+	char* buffer;
+	UhdaSimpleStream* sources;
+	// periods that may contain something other than silence, one bit per period
+	uint32_t dirty_periods[(SIMPLE_PERIOD_COUNT + 31) / 32];
+	// the count of zero bytes written right before the fill position
+	uint32_t silent_run;
+	// the count of bytes filled with only silence since the last audio
+	uint32_t idle_bytes;
+	// the count of silent periods after which the stream is paused, 0 if disabled
+	uint32_t idle_pause_periods;
+	// the stream was paused because it was idle and is resumed once there is data
+	bool idle_paused;
+	// the total count of bytes filled and read by the controller, used to tell when buffers have been played
+	uint64_t filled_bytes;
+	uint64_t played_bytes;
+	// the base stream was allocated by `uhda_simple_stream_alloc` and is released with the last source
+	bool pooled;
 
 	[[nodiscard]] uint32_t get_software_ahead(uint32_t pos) const {
 		uint32_t software_ahead;
@@ -104,110 +264,651 @@ struct UhdaSimpleStream {
 
 		return software_ahead;
 	}
+
+	[[nodiscard]] bool any_playing() const;
+
+	void mark_dirty(uint32_t pos, uint32_t size) {
+		if (!size) {
+			return;
+		}
+
+		uint32_t end = (pos + size - 1) / SIMPLE_PERIOD_SIZE;
+		for (uint32_t period = pos / SIMPLE_PERIOD_SIZE; period <= end; ++period) {
+			dirty_periods[period / 32] |= 1U << (period % 32);
+		}
+		silent_run = 0;
+	}
+
+	void mark_all_dirty() {
+		for (auto& bits : dirty_periods) {
+			bits = 0xFFFFFFFF;
+		}
+		silent_run = 0;
+	}
+
+	/*
+	 * Writes silence at `pos`, periods that are already silent are skipped.
+	 */
+	void write_silence(char* ptr, uint32_t pos, uint32_t size) {
+		while (size) {
+			uint32_t period = pos / SIMPLE_PERIOD_SIZE;
+			uint32_t offset = pos % SIMPLE_PERIOD_SIZE;
+			uint32_t chunk = UHDA_MIN(size, SIMPLE_PERIOD_SIZE - offset);
+
+			uint32_t bit = 1U << (period % 32);
+			if (dirty_periods[period / 32] & bit) {
+				dma_zero(ptr, chunk);
+			}
+
+			silent_run += chunk;
+			// the period is clean once it was zeroed from start to end
+			if (offset + chunk == SIMPLE_PERIOD_SIZE && silent_run >= SIMPLE_PERIOD_SIZE) {
+				dirty_periods[period / 32] &= ~bit;
+			}
+
+			ptr += chunk;
+			pos += chunk;
+			size -= chunk;
+		}
+	}
 };
 
-UhdaStatus uhda_simple_stream_new(UhdaStream* base, UhdaSimpleStream** res) {
+struct UhdaSimpleStream {
+	SharedStream* shared;
+	UhdaSimpleStream* next;
+	RingBuffer buffer;
+	UhdaSimpleWatermarkFn watermark_fn;
+	void* watermark_arg;
+	uint32_t low_watermark;
+	uint32_t high_watermark;
+	UhdaSimplePullFn pull_fn;
+	void* pull_arg;
+	// client buffers that haven't been copied completely, each one is played after the ring data
+	// queued before it which is counted in its `ring_before`
+	BufferQueue pending;
+	// client buffers that have been copied and are waiting for the controller to read them
+	BufferQueue copied;
+	// the amount of data left in the pending buffers
+	uint32_t buffered;
+	// the amount of ring data queued after the last pending buffer
+	uint32_t ring_after;
+	bool playing;
+	// the low watermark notification is sent once the queue drops to it and armed again above the high one
+	bool watermark_armed;
+
+	[[nodiscard]] uint32_t queued() const {
+		return buffer.size + buffered;
+	}
+
+	// adds data to the ring, it's played after the buffers queued before it
+	void write(const void* data, uint32_t size) {
+		buffer.write(data, size);
+		if (pending.tail) {
+			ring_after += size;
+		}
+	}
+
+	void push_buffer(UhdaSimpleBuffer* client) {
+		client->offset = 0;
+		client->ring_before = pending.tail ? ring_after : buffer.size;
+		client->end = 0;
+		ring_after = 0;
+		pending.push(client);
+		buffered += client->size;
+	}
+
+	/*
+	 * Removes `size` bytes from the ring and the pending buffers in the order they were queued,
+	 * `pos` is the filled byte count the data is written at. `fn` is called with the offset and the parts of the data.
+	 */
+	template<typename F>
+	void consume(uint64_t pos, uint32_t size, F fn) {
+		uint32_t i = 0;
+		while (i < size) {
+			auto client = pending.head;
+			if (!client || client->ring_before) {
+				uint32_t chunk = UHDA_MIN(size - i, client ? client->ring_before : buffer.size);
+				buffer.consume(chunk, [&](uint32_t offset, const char* src, uint32_t part) {
+					fn(i + offset, src, part);
+				});
+				if (client) {
+					client->ring_before -= chunk;
+				}
+				i += chunk;
+				continue;
+			}
+
+			uint32_t chunk = UHDA_MIN(size - i, client->size - client->offset);
+			fn(i, static_cast<const char*>(client->data) + client->offset, chunk);
+
+			client->offset += chunk;
+			buffered -= chunk;
+			i += chunk;
+
+			if (client->offset == client->size) {
+				// the buffer has been played once the controller has read past its end
+				client->end = pos + i;
+				copied.push(pending.pop());
+				if (!pending.head) {
+					ring_after = 0;
+				}
+			}
+		}
+	}
+
+	void read(uint64_t pos, void* data, uint32_t to_read) {
+		auto* data_ptr = static_cast<char*>(data);
+		consume(pos, to_read, [&](uint32_t offset, const char* src, uint32_t chunk) {
+			memcpy(data_ptr + offset, src, chunk);
+		});
+	}
+
+	// like `read` but for memory read by the controller
+	void read_dma(uint64_t pos, void* data, uint32_t to_read) {
+		auto* data_ptr = static_cast<char*>(data);
+		consume(pos, to_read, [&](uint32_t offset, const char* src, uint32_t chunk) {
+			dma_copy(data_ptr + offset, src, chunk);
+		});
+	}
+
+	/*
+	 * Like `read` but adds the samples to the ones in `data` instead of replacing them.
+	 */
+	void mix(uint64_t pos, void* data, uint32_t to_read, uint32_t sample_size) {
+		auto* data_ptr = static_cast<char*>(data);
+		consume(pos, to_read, [&](uint32_t offset, const char* src, uint32_t chunk) {
+			mix_samples(data_ptr + offset, src, chunk, sample_size);
+		});
+	}
+
+	/*
+	 * Moves the copied buffers the controller has read past `played` to `done`.
+	 */
+	void collect_played(uint64_t played, BufferQueue& done) {
+		while (copied.head && copied.head->end <= played) {
+			done.push(copied.pop());
+		}
+	}
+
+	/*
+	 * Asks the client for the data missing from the ring to fill `size` bytes.
+	 */
+	void pull(uint32_t size) {
+		// pulled data would be played before the pending buffers
+		if (buffer.size >= size || pending.head) {
+			return;
+		}
+
+		uint32_t to_pull = UHDA_MIN(size - buffer.size, buffer.capacity - buffer.size);
+		buffer.produce(to_pull, [&](char* data, uint32_t chunk) {
+			return pull_fn(this, data, chunk, pull_arg);
+		});
+	}
+};
+
+bool SharedStream::any_playing() const {
+	for (auto source = sources; source; source = source->next) {
+		if (source->playing) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static UhdaSimpleStream* uhda_simple_stream_create(SharedStream* shared) {
 	auto* stream = static_cast<UhdaSimpleStream*>(uhda_kernel_malloc(sizeof(UhdaSimpleStream)));
 	if (!stream) {
-		return UHDA_STATUS_NO_MEMORY;
+		return nullptr;
 	}
 	*stream = {};
-	stream->base = base;
+	stream->shared = shared;
+	return stream;
+}
 
-	auto status = uhda_kernel_create_spinlock(&stream->lock);
+UhdaStatus uhda_simple_stream_new(UhdaStream* base, UhdaSimpleStream** res) {
+	auto* shared = static_cast<SharedStream*>(uhda_kernel_malloc(sizeof(SharedStream)));
+	if (!shared) {
+		return UHDA_STATUS_NO_MEMORY;
+	}
+	*shared = {};
+	shared->base = base;
+
+	auto status = uhda_kernel_create_spinlock(&shared->lock);
+	if (status != UHDA_STATUS_SUCCESS) {
+		uhda_kernel_free(shared, sizeof(SharedStream));
+		return status;
+	}
+
+	auto* stream = uhda_simple_stream_create(shared);
+	if (!stream) {
+		uhda_kernel_free_spinlock(shared->lock);
+		uhda_kernel_free(shared, sizeof(SharedStream));
+		return UHDA_STATUS_NO_MEMORY;
+	}
+	shared->sources = stream;
+
+	*res = stream;
+	return UHDA_STATUS_SUCCESS;
+}
+
+static UhdaStatus uhda_simple_stream_join(
+	UhdaController* controller,
+	const UhdaSimpleStreamParams* params,
+	UhdaSimpleStream** res) {
+	if (!mix_sample_size(params->fmt)) {
+		return UHDA_STATUS_UNSUPPORTED;
+	}
+
+	auto* stream = uhda_simple_stream_create(nullptr);
+	if (!stream) {
+		return UHDA_STATUS_NO_MEMORY;
+	}
+
+	auto status = stream->buffer.init(params->ring_buffer_size);
 	if (status != UHDA_STATUS_SUCCESS) {
 		uhda_kernel_free(stream, sizeof(UhdaSimpleStream));
 		return status;
 	}
 
+	// the controller lock keeps the shared streams from being released while joining one
+	LockGuard guard {controller->lock};
+	for (uint8_t i = 0; i < controller->out_stream_count; ++i) {
+		auto shared = static_cast<SharedStream*>(controller->out_streams[i].mixer);
+		if (!shared ||
+			shared->params.sample_rate != params->sample_rate ||
+			shared->params.channels != params->channels ||
+			shared->params.fmt != params->fmt) {
+			continue;
+		}
+
+		LockGuard shared_guard {shared->lock};
+		stream->shared = shared;
+		stream->next = shared->sources;
+		shared->sources = stream;
+
+		*res = stream;
+		return UHDA_STATUS_SUCCESS;
+	}
+
+	stream->buffer.destroy();
+	uhda_kernel_free(stream, sizeof(UhdaSimpleStream));
+	// no stream has the same format, no allocation failed
+	return UHDA_STATUS_UNSUPPORTED;
+}
+
+UhdaStatus uhda_simple_stream_alloc(
+	UhdaController* controller,
+	const UhdaSimpleStreamParams* params,
+	UhdaSimpleStream** res) {
+	UhdaStream* base;
+	auto status = uhda_stream_alloc(controller, true, &base);
+	if (status == UHDA_STATUS_NO_MEMORY) {
+		// all hardware streams are in use, mix the stream into one with the same format
+		return uhda_simple_stream_join(controller, params, res);
+	}
+	else if (status != UHDA_STATUS_SUCCESS) {
+		return status;
+	}
+
+	UhdaSimpleStream* stream;
+	status = uhda_simple_stream_new(base, &stream);
+	if (status != UHDA_STATUS_SUCCESS) {
+		uhda_stream_free(base);
+		return status;
+	}
+	stream->shared->pooled = true;
+
+	status = uhda_simple_stream_setup(stream, params);
+	if (status != UHDA_STATUS_SUCCESS) {
+		uhda_simple_stream_destroy(stream);
+		return status;
+	}
+
+	if (mix_sample_size(params->fmt)) {
+		LockGuard guard {controller->lock};
+		base->mixer = stream->shared;
+	}
+
 	*res = stream;
 	return UHDA_STATUS_SUCCESS;
 }
 
 void uhda_simple_stream_destroy(UhdaSimpleStream* stream) {
+	auto shared = stream->shared;
+	auto base = shared->base;
+
+	bool last;
+	{
+		// new streams can only join pooled streams while holding the controller lock
+		void* controller_lock = shared->pooled ? base->controller->lock : nullptr;
+		UhdaIrqState irq_state {};
+		if (controller_lock) {
+			irq_state = uhda_kernel_lock_spinlock(controller_lock);
+		}
+
+		{
+			LockGuard guard {shared->lock};
+			auto* link = &shared->sources;
+			while (*link != stream) {
+				link = &(*link)->next;
+			}
+			*link = stream->next;
+
+			last = !shared->sources;
+			// stopped under the lock so that it can't race with another stream starting it,
+			// a base stream owned by the caller is left alone
+			if (shared->pooled && !shared->any_playing()) {
+				uhda_stream_play(base, false);
+			}
+		}
+
+		if (last) {
+			base->mixer = nullptr;
+		}
+
+		if (controller_lock) {
+			uhda_kernel_unlock_spinlock(controller_lock, irq_state);
+		}
+	}
+
+	// the stream isn't reachable from the period callback anymore
+	stream->pending.append(stream->copied);
+	stream->pending.complete(false);
+
 	stream->buffer.destroy();
-	uhda_kernel_free_spinlock(stream->lock);
 	uhda_kernel_free(stream, sizeof(UhdaSimpleStream));
+
+	if (!shared->pooled) {
+		// the base stream belongs to the caller
+		if (last) {
+			uhda_kernel_free_spinlock(shared->lock);
+			uhda_kernel_free(shared, sizeof(SharedStream));
+		}
+		return;
+	}
+
+	if (last) {
+		uhda_stream_shutdown(base);
+		uhda_stream_free(base);
+		uhda_kernel_free_spinlock(shared->lock);
+		uhda_kernel_free(shared, sizeof(SharedStream));
+	}
 }
 
 UhdaStatus uhda_simple_path_setup(UhdaPath* path, UhdaSimpleStream* stream) {
-	return uhda_path_setup(path, &stream->params, stream->base);
+	return uhda_path_setup(path, &stream->shared->params, stream->shared->base);
 }
 
-static void uhda_copy_bytes_from_ring(UhdaSimpleStream* stream, uint32_t size) {
-	uint32_t buffer_size = stream->params.period_count * stream->params.period_size;
+/*
+ * Fills `dst` with the mix of all playing sources, the first one is copied and the rest are mixed into it.
+ */
+static void uhda_mix_sources(SharedStream* shared, uint64_t pos, char* dst, uint32_t size, uint32_t sample_size) {
+	uint32_t copy_progress = 0;
+	bool first = true;
+	for (auto source = shared->sources; source; source = source->next) {
+		if (!source->playing || !source->queued()) {
+			continue;
+		}
 
+		uint32_t ring_to_copy = UHDA_MIN(size, source->queued());
+		if (first) {
+			source->read(pos, dst, ring_to_copy);
+			copy_progress = ring_to_copy;
+			first = false;
+			continue;
+		}
+
+		ring_to_copy -= ring_to_copy % sample_size;
+		if (ring_to_copy > copy_progress) {
+			memset(dst + copy_progress, 0, ring_to_copy - copy_progress);
+			copy_progress = ring_to_copy;
+		}
+		source->mix(pos, dst, ring_to_copy, sample_size);
+	}
+
+	if (copy_progress != size) {
+		memset(dst + copy_progress, 0, size - copy_progress);
+	}
+}
+
+/*
+ * Fills `size` bytes at the fill position, returns whether any audio was written.
+ */
+static bool uhda_copy_bytes_from_ring(SharedStream* shared, uint32_t size) {
+	uint32_t buffer_size = shared->params.period_count * shared->params.period_size;
+	uint32_t sample_size = mix_sample_size(shared->params.fmt);
+
+	bool audio = false;
+
+	for (auto source = shared->sources; source; source = source->next) {
+		if (source->pull_fn && source->playing) {
+			source->pull(size);
+		}
+	}
 	while (size) {
-		uint32_t period = stream->current_fill_pos / 0x1000;
-		uint32_t period_offset = stream->current_fill_pos % 0x1000;
-		auto* period_ptr = static_cast<char*>(stream->chunks[period].virt);
-		period_ptr += period_offset;
+		char* period_ptr;
+		uint32_t to_copy_period;
+		if (shared->buffer) {
+			period_ptr = shared->buffer + shared->current_fill_pos;
+			to_copy_period = UHDA_MIN(size, buffer_size - shared->current_fill_pos);
+		}
+		else {
+			uint32_t period = shared->current_fill_pos / SIMPLE_PERIOD_SIZE;
+			uint32_t period_offset = shared->current_fill_pos % SIMPLE_PERIOD_SIZE;
+			period_ptr = static_cast<char*>(shared->chunks[period].virt);
+			period_ptr += period_offset;
 
-		uint32_t to_copy_period = UHDA_MIN(size, 0x1000 - period_offset);
+			to_copy_period = UHDA_MIN(size, SIMPLE_PERIOD_SIZE - period_offset);
+		}
 
-		uint32_t copy_progress = 0;
+		UhdaSimpleStream* first = nullptr;
+		bool mixing = false;
+		for (auto source = shared->sources; source; source = source->next) {
+			if (!source->playing || !source->queued()) {
+				continue;
+			}
 
-		if (stream->buffer.size) {
-			uint32_t ring_to_copy = UHDA_MIN(to_copy_period, stream->buffer.size);
-			stream->buffer.read(period_ptr, ring_to_copy);
-			copy_progress += ring_to_copy;
+			if (first) {
+				mixing = true;
+				break;
+			}
+			first = source;
 		}
 
-		if (copy_progress != to_copy_period) {
-			memset(period_ptr + copy_progress, 0, to_copy_period - copy_progress);
+		if (mixing) {
+			// mixing reads back what it has written, which is slow for uncached memory so it's done in a cached block
+			for (uint32_t offset = 0; offset < to_copy_period; offset += MIX_BLOCK_SIZE) {
+				char block[MIX_BLOCK_SIZE];
+				uint32_t block_size = UHDA_MIN(to_copy_period - offset, MIX_BLOCK_SIZE);
+				uhda_mix_sources(shared, shared->filled_bytes + offset, block, block_size, sample_size);
+				dma_copy(period_ptr + offset, block, block_size);
+			}
+			shared->mark_dirty(shared->current_fill_pos, to_copy_period);
+			audio = true;
 		}
+		else {
+			uint32_t copy_progress = 0;
+			if (first) {
+				copy_progress = UHDA_MIN(to_copy_period, first->queued());
+				first->read_dma(shared->filled_bytes, period_ptr, copy_progress);
+				shared->mark_dirty(shared->current_fill_pos, copy_progress);
+				audio = true;
+			}
+
+			if (copy_progress != to_copy_period) {
+				shared->write_silence(
+					period_ptr + copy_progress,
+					shared->current_fill_pos + copy_progress,
+					to_copy_period - copy_progress);
+			}
+		}
+
+		uhda_stream_flush(shared->base, shared->current_fill_pos, to_copy_period);
 
 		size -= to_copy_period;
-		stream->current_fill_pos += to_copy_period;
+		shared->current_fill_pos += to_copy_period;
+		shared->filled_bytes += to_copy_period;
 
-		if (stream->current_fill_pos == buffer_size) {
-			stream->current_fill_pos = 0;
+		if (shared->current_fill_pos == buffer_size) {
+			shared->current_fill_pos = 0;
 		}
 	}
+
+	return audio;
 }
 
-static void uhda_simple_period_callback(UhdaStream*, void* arg) {
-	auto* stream = static_cast<UhdaSimpleStream*>(arg);
+/*
+ * Restarts a stream paused for being idle from the current position so that the new data is played right away,
+ * must be called with the lock held.
+ */
+static void uhda_resume_idle(SharedStream* shared) {
+	shared->idle_paused = false;
+	shared->idle_bytes = 0;
 
-	LockGuard guard {stream->lock};
+	auto pos = uhda_stream_get_position(shared->base);
+	uint32_t buffer_size = shared->params.period_count * shared->params.period_size;
+	shared->played_bytes += (pos + buffer_size - shared->prev_irq_pos) % buffer_size;
+	// the periods filled ahead were silent so no buffer is waiting for them to be played
+	shared->filled_bytes = shared->played_bytes;
+	shared->current_fill_pos = pos;
+	shared->prev_irq_pos = pos;
+	// the silence before the fill position was cut short
+	shared->silent_run = 0;
 
-	uint32_t buffer_size = stream->params.period_count * stream->params.period_size;
+	uhda_copy_bytes_from_ring(shared, ALLOWED_SOFTWARE_AHEAD);
+	uhda_stream_play(shared->base, true);
+}
 
-	uint32_t pos = uhda_stream_get_position(stream->base);
+namespace {
+	struct WatermarkNotification {
+		UhdaSimpleStream* stream;
+		uint32_t remaining;
+	};
+
+	// notifications sent from one period callback, the rest are sent from the next one
+	constexpr size_t MAX_NOTIFICATIONS = 8;
+}
+
+/*
+ * Fills the periods consumed since the last callback and collects the watermark notifications to send
+ * and the buffers that have been played, returns the count of notifications.
+ */
+static size_t uhda_simple_period_fill(
+	SharedStream* shared,
+	WatermarkNotification* notifications,
+	BufferQueue& played) {
+	size_t notification_count = 0;
+
+	LockGuard guard {shared->lock};
+
+	uint32_t buffer_size = shared->params.period_count * shared->params.period_size;
+
+	uint32_t pos = uhda_stream_get_position(shared->base);
 
 	uint32_t bytes_after_last_irq;
-	if (pos >= stream->prev_irq_pos) {
-		bytes_after_last_irq = pos - stream->prev_irq_pos;
+	if (pos >= shared->prev_irq_pos) {
+		bytes_after_last_irq = pos - shared->prev_irq_pos;
+	}
+	else {
+		bytes_after_last_irq = buffer_size - shared->prev_irq_pos + pos;
+	}
+	shared->played_bytes += bytes_after_last_irq;
+
+	if (uhda_copy_bytes_from_ring(shared, bytes_after_last_irq)) {
+		shared->idle_bytes = 0;
 	}
 	else {
-		bytes_after_last_irq = buffer_size - stream->prev_irq_pos + pos;
+		shared->idle_bytes += bytes_after_last_irq;
+	}
+
+	shared->prev_irq_pos = pos;
+
+	// the periods filled ahead have to be played before the stream has really been silent for long enough
+	if (shared->idle_pause_periods &&
+		shared->idle_bytes >= shared->idle_pause_periods * SIMPLE_PERIOD_SIZE + ALLOWED_SOFTWARE_AHEAD) {
+		uhda_stream_play(shared->base, false);
+		shared->idle_paused = true;
+	}
+
+	for (auto source = shared->sources; source; source = source->next) {
+		source->collect_played(shared->played_bytes, played);
+
+		if (notification_count < MAX_NOTIFICATIONS &&
+			source->watermark_fn &&
+			source->watermark_armed &&
+			source->queued() <= source->low_watermark) {
+			source->watermark_armed = false;
+			notifications[notification_count++] = {source, source->queued()};
+		}
 	}
 
-	uhda_copy_bytes_from_ring(stream, bytes_after_last_irq);
+	return notification_count;
+}
+
+static void uhda_simple_period_callback(UhdaStream*, void* arg) {
+	auto* shared = static_cast<SharedStream*>(arg);
+
+	// the callbacks are called without the lock so that they can queue more data
+	WatermarkNotification notifications[MAX_NOTIFICATIONS];
+	BufferQueue played {};
+	size_t notification_count = uhda_simple_period_fill(shared, notifications, played);
+
+	played.complete(true);
 
-	stream->prev_irq_pos = pos;
+	for (size_t i = 0; i < notification_count; ++i) {
+		auto& notification = notifications[i];
+		notification.stream->watermark_fn(
+			notification.stream,
+			notification.remaining,
+			notification.stream->watermark_arg);
+	}
 }
 
 UhdaStatus uhda_simple_stream_setup(UhdaSimpleStream* stream, const UhdaSimpleStreamParams* params) {
+	auto shared = stream->shared;
+	if (shared->sources != stream || stream->next) {
+		return UHDA_STATUS_UNSUPPORTED;
+	}
+
 	auto status = stream->buffer.init(params->ring_buffer_size);
 	if (status != UHDA_STATUS_SUCCESS) {
 		return status;
 	}
 
-	stream->params = {
+	shared->params = {
 		.sample_rate = params->sample_rate,
 		.channels = params->channels,
 		.fmt = params->fmt,
-		.period_count = 256,
-		.period_size = 0x1000,
+		.period_count = SIMPLE_PERIOD_COUNT,
+		.period_size = SIMPLE_PERIOD_SIZE,
 		.period_callback_distance = 1,
 		.period_callback = uhda_simple_period_callback,
-		.period_callback_arg = stream
+		.period_callback_arg = shared,
+		.contiguous = true,
+		// the periods are filled through `chunks` one page at a time, so they must not be split
+		.chunk_size = 0
 	};
 
-	status = uhda_stream_setup(stream->base, &stream->params);
+	status = uhda_stream_setup(shared->base, &shared->params);
+	if (status == UHDA_STATUS_NO_MEMORY) {
+		// a megabyte of contiguous memory might not be available, the ring can be copied period by period too
+		shared->params.contiguous = false;
+		status = uhda_stream_setup(shared->base, &shared->params);
+	}
+
 	if (status == UHDA_STATUS_SUCCESS) {
-		uhda_stream_get_periods(stream->base, &stream->chunks);
+		uhda_stream_get_periods(shared->base, &shared->chunks);
+		// the buffers may come from a previous stream
+		shared->mark_all_dirty();
+
+		UhdaScatterChunk buffer;
+		uint32_t buffer_size;
+		if (uhda_stream_get_buffer(shared->base, &buffer, &buffer_size) == UHDA_STATUS_SUCCESS) {
+			shared->buffer = static_cast<char*>(buffer.virt);
+		}
+		else {
+			shared->buffer = nullptr;
+		}
 	}
 	else {
 		stream->buffer.destroy();
@@ -217,40 +918,188 @@ UhdaStatus uhda_simple_stream_setup(UhdaSimpleStream* stream, const UhdaSimpleSt
 }
 
 UhdaStatus uhda_simple_stream_play(UhdaSimpleStream* stream, bool play) {
-	auto status = uhda_stream_get_status(stream->base);
+	auto shared = stream->shared;
+
+	LockGuard guard {shared->lock};
+	stream->playing = play;
+	bool running = shared->any_playing();
+
+	if (running && shared->idle_paused) {
+		uhda_resume_idle(shared);
+		return UHDA_STATUS_SUCCESS;
+	}
+	shared->idle_paused = false;
+	shared->idle_bytes = 0;
 
-	if (status == UHDA_STREAM_STATUS_PAUSED) {
-		auto pos = uhda_stream_get_position(stream->base);
-		auto software_ahead = stream->get_software_ahead(pos);
+	auto status = uhda_stream_get_status(shared->base);
+	if (running && status == UHDA_STREAM_STATUS_PAUSED) {
+		auto pos = uhda_stream_get_position(shared->base);
+		auto software_ahead = shared->get_software_ahead(pos);
 
 		if (software_ahead < ALLOWED_SOFTWARE_AHEAD) {
 			uint32_t allowed_copy = ALLOWED_SOFTWARE_AHEAD - software_ahead;
-			uhda_copy_bytes_from_ring(stream, allowed_copy);
+			uhda_copy_bytes_from_ring(shared, allowed_copy);
 		}
 	}
 
-	return uhda_stream_play(stream->base, play);
+	// the base stream keeps running as long as any of the streams mixed into it is playing,
+	// it's started under the lock so that it can't race with an idle pause from the period callback
+	return uhda_stream_play(shared->base, running);
+}
+
+/*
+ * Updates the stream after `size` bytes were queued to it, must be called with the lock held.
+ */
+static void uhda_simple_stream_queued(UhdaSimpleStream* stream, uint32_t size) {
+	auto shared = stream->shared;
+	if (size && stream->playing && shared->idle_paused) {
+		uhda_resume_idle(shared);
+	}
+
+	if (stream->queued() >= stream->high_watermark) {
+		stream->watermark_armed = true;
+	}
 }
 
 UhdaStatus uhda_simple_stream_queue_data(UhdaSimpleStream* stream, const void* data, uint32_t* size) {
-	LockGuard guard {stream->lock};
+	LockGuard guard {stream->shared->lock};
 
 	uint32_t to_copy = UHDA_MIN(*size, stream->buffer.capacity - stream->buffer.size);
-	stream->buffer.write(data, to_copy);
+	stream->write(data, to_copy);
 	*size = to_copy;
 
+	uhda_simple_stream_queued(stream, to_copy);
 	return UHDA_STATUS_SUCCESS;
 }
 
+UhdaStatus uhda_simple_stream_queue_segments(
+	UhdaSimpleStream* stream,
+	const UhdaSimpleSegment* segments,
+	size_t count,
+	uint32_t* size) {
+	LockGuard guard {stream->shared->lock};
+
+	uint32_t total = 0;
+	for (size_t i = 0; i < count; ++i) {
+		uint32_t to_copy = UHDA_MIN(segments[i].size, stream->buffer.capacity - stream->buffer.size);
+		stream->write(segments[i].data, to_copy);
+		total += to_copy;
+
+		if (to_copy != segments[i].size) {
+			break;
+		}
+	}
+	*size = total;
+
+	uhda_simple_stream_queued(stream, total);
+	return UHDA_STATUS_SUCCESS;
+}
+
+UhdaStatus uhda_simple_stream_queue_planar(
+	UhdaSimpleStream* stream,
+	const void* const* planes,
+	uint32_t* frames) {
+	auto shared = stream->shared;
+	LockGuard guard {shared->lock};
+
+	uint32_t channels = shared->params.channels;
+	uint32_t sample = sample_size(shared->params.fmt);
+	uint32_t frame_size = channels * sample;
+	if (!frame_size || frame_size > INTERLEAVE_BLOCK_SIZE) {
+		return UHDA_STATUS_UNSUPPORTED;
+	}
+
+	uint32_t to_copy = UHDA_MIN(*frames, (stream->buffer.capacity - stream->buffer.size) / frame_size);
+	uint32_t block_frames = INTERLEAVE_BLOCK_SIZE / frame_size;
+
+	// the frames are interleaved in a block first as the end of the ring might split one
+	char block[INTERLEAVE_BLOCK_SIZE];
+	for (uint32_t frame = 0; frame < to_copy; frame += block_frames) {
+		uint32_t count = UHDA_MIN(to_copy - frame, block_frames);
+		for (uint32_t channel = 0; channel < channels; ++channel) {
+			auto* src = static_cast<const char*>(planes[channel]) + frame * sample;
+			auto* dst = block + channel * sample;
+			for (uint32_t i = 0; i < count; ++i) {
+				memcpy(dst, src, sample);
+				src += sample;
+				dst += frame_size;
+			}
+		}
+		stream->write(block, count * frame_size);
+	}
+	*frames = to_copy;
+
+	uhda_simple_stream_queued(stream, to_copy * frame_size);
+	return UHDA_STATUS_SUCCESS;
+}
+
+UhdaStatus uhda_simple_stream_queue_buffer(UhdaSimpleStream* stream, UhdaSimpleBuffer* buffer) {
+	if (!buffer->size) {
+		return UHDA_STATUS_UNSUPPORTED;
+	}
+
+	LockGuard guard {stream->shared->lock};
+
+	stream->push_buffer(buffer);
+
+	uhda_simple_stream_queued(stream, buffer->size);
+	return UHDA_STATUS_SUCCESS;
+}
+
+UhdaStatus uhda_simple_stream_set_watermarks(
+	UhdaSimpleStream* stream,
+	uint32_t low,
+	uint32_t high,
+	UhdaSimpleWatermarkFn fn,
+	void* arg) {
+	if (low > high) {
+		return UHDA_STATUS_UNSUPPORTED;
+	}
+
+	LockGuard guard {stream->shared->lock};
+	stream->watermark_fn = fn;
+	stream->watermark_arg = arg;
+	stream->low_watermark = low;
+	stream->high_watermark = high;
+	stream->watermark_armed = stream->queued() >= high;
+	return UHDA_STATUS_SUCCESS;
+}
+
+void uhda_simple_stream_set_pull(UhdaSimpleStream* stream, UhdaSimplePullFn fn, void* arg) {
+	LockGuard guard {stream->shared->lock};
+	stream->pull_fn = fn;
+	stream->pull_arg = arg;
+}
+
+void uhda_simple_stream_set_idle_pause(UhdaSimpleStream* stream, uint32_t silent_periods) {
+	auto shared = stream->shared;
+	LockGuard guard {shared->lock};
+	shared->idle_pause_periods = silent_periods;
+	shared->idle_bytes = 0;
+
+	if (!silent_periods && shared->idle_paused && shared->any_playing()) {
+		uhda_resume_idle(shared);
+	}
+}
+
 UhdaStatus uhda_simple_stream_clear_queue(UhdaSimpleStream* stream) {
-	LockGuard guard {stream->lock};
-	stream->buffer.clear();
+	BufferQueue removed {};
+	{
+		LockGuard guard {stream->shared->lock};
+		stream->buffer.clear();
+		removed = stream->pending;
+		stream->pending = {};
+		stream->buffered = 0;
+		stream->ring_after = 0;
+	}
+
+	removed.complete(false);
 	return UHDA_STATUS_SUCCESS;
 }
 
 UhdaStatus uhda_simple_stream_get_remaining(const UhdaSimpleStream* stream, uint32_t* remaining) {
-	LockGuard guard {stream->lock};
-	*remaining = stream->buffer.size;
+	LockGuard guard {stream->shared->lock};
+	*remaining = stream->queued();
 	return UHDA_STATUS_SUCCESS;
 }
 
@@ -259,5 +1108,5 @@ uint32_t uhda_simple_stream_get_buffer_size(const UhdaSimpleStream* stream) {
 }
 
 UhdaStream* uhda_simple_stream_get_base(const UhdaSimpleStream* stream) {
-	return stream->base;
+	return stream->shared->base;
 }
@@ -114,6 +114,11 @@ namespace uhda {
 		static constexpr BitField<uint8_t, bool> bois {2, 1};
 	}
 
+	namespace icis {
+		static constexpr BitField<uint16_t, bool> ICB {0, 1};
+		static constexpr BitField<uint16_t, bool> IRV {1, 1};
+	}
+
 	namespace rirbsize {
 		static constexpr BitField<uint8_t, uint8_t> SIZE {0, 2};
 		static constexpr BitField<uint8_t, uint8_t> SZCAP {4, 4};
@@ -499,6 +504,22 @@ namespace uhda {
 	struct VerbDescriptor {
 		BitValue<uint32_t> value;
 
+		/*
+		 * Creates a verb, verbs with 4-bit identifiers carry 16 bits of data and the rest 8 bits.
+		 */
+		static constexpr VerbDescriptor make(uint8_t cid, uint8_t nid, uint16_t cmd, uint16_t data) {
+			VerbDescriptor verb {};
+			verb.set_cid(cid);
+			verb.set_nid(nid);
+			if (cmd <= 0xF) {
+				verb.set_payload(static_cast<uint32_t>(cmd) << 16 | data);
+			}
+			else {
+				verb.set_payload(static_cast<uint32_t>(cmd) << 8 | (data & 0xFF));
+			}
+			return verb;
+		}
+
 		constexpr void set_payload(uint32_t payload) {
 			value |= verb::PAYLOAD(payload);
 		}
@@ -545,6 +566,7 @@ namespace uhda {
 			SET_POWER_STATE = 0X705,
 			SET_CONVERTER_CONTROL = 0x706,
 			SET_PIN_CONTROL = 0x707,
+			SET_UNSOL_ENABLE = 0x708,
 			SET_PIN_SENSE = 0x709,
 			SET_EAPD_ENABLE = 0x70C,
 			SET_VOLUME_KNOB = 0x70F,
@@ -554,6 +576,8 @@ namespace uhda {
 
 	namespace param {
 		enum : uint8_t {
+			VENDOR_ID = 0x0,
+			REVISION_ID = 0x2,
 			NODE_COUNT = 0x4,
 			FUNC_GROUP_TYPE = 0x5,
 			AUDIO_CAPS = 0x9,
@@ -1,10 +1,17 @@
 #include "stream.hpp"
+#include "controller.hpp"
 #include "fmt_utils.hpp"
+#include "lock_guard.hpp"
 #include "scope_guard.hpp"
 #include "uhda/kernel_api.h"
+#include "wait.hpp"
 
 using namespace uhda;
 
+namespace {
+	constexpr uint32_t STREAM_RESET_TIMEOUT_US = 10 * 1000;
+}
+
 UhdaStream::~UhdaStream() {
 	destroy();
 }
@@ -13,34 +20,82 @@ UhdaStatus UhdaStream::setup(const UhdaStreamParams* params) {
 	PcmFormat fmt = pcm_format_from_params(params->sample_rate, params->channels, params->fmt);
 	space.store(regs::stream::FMT, fmt.value);
 
-	UHDA_TRY(uhda_kernel_allocate_physical(0x1000, &bdl_phys));
-
 	ScopeGuard destroy_guard {[&] {
 		destroy();
 	}};
 
-	void* bdl_ptr;
-	UHDA_TRY(uhda_kernel_map(bdl_phys, 0x1000, &bdl_ptr));
-	bdl = launder(static_cast<BufferDescriptor*>(bdl_ptr));
+	DmaLayout layout {
+		.period_count = params->period_count,
+		.period_size = params->period_size,
+		.chunk_size = params->period_size,
+		.contiguous = params->contiguous,
+		.map_type = params->contiguous ? controller->buffer_map_type : UHDA_MAP_TYPE_UNCACHEABLE
+	};
+	// splitting the periods of a contiguous buffer wouldn't save any contiguous memory
+	if (!params->contiguous && params->chunk_size && params->chunk_size < params->period_size) {
+		layout.chunk_size = params->chunk_size;
+	}
 
-	bdl_chunks = static_cast<UhdaScatterChunk*>(uhda_kernel_malloc(params->period_count * sizeof(UhdaScatterChunk)));
-	if (!bdl_chunks) {
-		return UHDA_STATUS_NO_MEMORY;
+	bool cached;
+	{
+		LockGuard guard {controller->lock};
+		cached = controller->dma_cache.take(layout, dma);
 	}
 
-	UHDA_TRY(uhda_kernel_allocate_scatter(params->period_count, params->period_size, bdl_chunks));
+	if (!cached) {
+		dma.layout = layout;
 
-	bdl_chunk_count = params->period_count;
-	bdl_chunk_size = params->period_size;
+		UHDA_TRY(uhda_kernel_allocate_physical(0x1000, &dma.bdl_phys));
 
-	for (size_t i = 0; i < bdl_chunk_count; ++i) {
-		if (bdl_chunks[i].phys % 128 != 0) {
-			return UHDA_STATUS_MISALIGNED_MEMORY;
+		void* bdl_ptr;
+		UHDA_TRY(uhda_kernel_map(dma.bdl_phys, 0x1000, &bdl_ptr));
+		dma.bdl = launder(static_cast<BufferDescriptor*>(bdl_ptr));
+
+		dma.chunks = static_cast<UhdaScatterChunk*>(uhda_kernel_malloc(layout.chunk_count() * sizeof(UhdaScatterChunk)));
+		if (!dma.chunks) {
+			return UHDA_STATUS_NO_MEMORY;
 		}
 
-		bdl[i].address = bdl_chunks[i].phys;
-		bdl[i].length = bdl_chunk_size;
-		bdl[i].ioc = i % params->period_callback_distance == 0;
+		if (layout.contiguous) {
+			uint32_t size = layout.buffer_size();
+			UHDA_TRY(uhda_kernel_allocate_physical(size, &dma.buffer_phys));
+#ifdef UHDA_KERNEL_HAS_MAP_TYPE
+			UHDA_TRY(uhda_kernel_map_type(dma.buffer_phys, size, layout.map_type, &dma.buffer));
+#else
+			UHDA_TRY(uhda_kernel_map(dma.buffer_phys, size, &dma.buffer));
+#endif
+
+			for (uint32_t i = 0; i < layout.period_count; ++i) {
+				dma.chunks[i] = {
+					.phys = dma.buffer_phys + i * layout.period_size,
+					.virt = static_cast<char*>(dma.buffer) + i * layout.period_size
+				};
+			}
+		}
+		else {
+			UHDA_TRY(uhda_kernel_allocate_scatter(layout.chunk_count(), layout.chunk_size, dma.chunks));
+			dma.scattered = true;
+		}
+
+		// validated before the buffers can end up in the cache, where they would be handed out again
+		for (uint32_t i = 0; i < layout.chunk_count(); ++i) {
+			if (dma.chunks[i].phys % 128 != 0) {
+				dma.free();
+				return UHDA_STATUS_MISALIGNED_MEMORY;
+			}
+		}
+	}
+
+	// the last chunk of a period only holds the rest of the period and raises the interrupt
+	uint32_t chunks_per_period = layout.chunks_per_period();
+	for (uint32_t i = 0; i < layout.chunk_count(); ++i) {
+		uint32_t period = i / chunks_per_period;
+		uint32_t chunk = i % chunks_per_period;
+		bool last = chunk == chunks_per_period - 1;
+
+		dma.bdl[i].address = dma.chunks[i].phys;
+		dma.bdl[i].length = last ? layout.period_size - chunk * layout.chunk_size : layout.chunk_size;
+		dma.bdl[i].ioc = last && period % params->period_callback_distance == 0;
 	}
 
 	period_callback = params->period_callback;
@@ -48,14 +103,14 @@ UhdaStatus UhdaStream::setup(const UhdaStreamParams* params) {
 
 	destroy_guard.done();
 
-	space.store(regs::stream::BDPL, bdl_phys);
-	space.store(regs::stream::BDPU, bdl_phys >> 32);
+	space.store(regs::stream::BDPL, dma.bdl_phys);
+	space.store(regs::stream::BDPU, dma.bdl_phys >> 32);
 
-	space.store(regs::stream::CBL, bdl_chunk_count * bdl_chunk_size);
+	space.store(regs::stream::CBL, layout.buffer_size());
 
 	auto lvi = space.load(regs::stream::LVI);
 	lvi &= ~sdlvi::LVI;
-	lvi |= sdlvi::LVI(bdl_chunk_count - 1);
+	lvi |= sdlvi::LVI(layout.chunk_count() - 1);
 	space.store(regs::stream::LVI, lvi);
 
 	auto ctl2 = space.load(regs::stream::CTL2);
@@ -70,35 +125,44 @@ UhdaStatus UhdaStream::setup(const UhdaStreamParams* params) {
 	return UHDA_STATUS_SUCCESS;
 }
 
-void UhdaStream::destroy() {
-	if (bdl_chunks) {
-		if (bdl_chunk_count != 0) {
-			uhda_kernel_deallocate_scatter(bdl_chunks, bdl_chunk_count, bdl_chunk_size);
-			bdl_chunk_count = 0;
+void UhdaStream::release_buffers() {
+	if (controller && dma.is_complete()) {
+		LockGuard guard {controller->lock};
+		if (controller->dma_cache.put(dma)) {
+			dma = {};
+			return;
 		}
-
-		uhda_kernel_free(bdl_chunks, bdl_chunk_count * sizeof(UhdaScatterChunk));
-		bdl_chunks = nullptr;
 	}
 
-	if (bdl) {
-		uhda_kernel_unmap(bdl, 0x1000);
-		bdl = nullptr;
-	}
+	dma.free();
+}
 
-	if (bdl_phys) {
-		uhda_kernel_deallocate_physical(bdl_phys, 0x1000);
-		bdl_phys = 0;
+void UhdaStream::destroy() {
+	// streams that the controller doesn't have are never assigned a register space
+	if (!space.base) {
+		release_buffers();
+		return;
 	}
 
+	// this may be called from the period callback, so the reset is only polled
+	Deadline deadline {STREAM_RESET_TIMEOUT_US};
 	space.store(regs::stream::CTL0, sdctl0::RST(true));
-	// todo maybe a timeout here,
-	// it's unlikely that the controller is broken at this point though.
-	while (!(space.load(regs::stream::CTL0) & sdctl0::RST));
+	while (!(space.load(regs::stream::CTL0) & sdctl0::RST) && !deadline.expired()) {
+		deadline.poll();
+	}
 	space.store(regs::stream::CTL0, 0);
-	while (space.load(regs::stream::CTL0) & sdctl0::RST);
+	while (space.load(regs::stream::CTL0) & sdctl0::RST) {
+		if (deadline.expired()) {
+			uhda_kernel_log("error: stream reset timed out");
+			break;
+		}
+		deadline.poll();
+	}
 
 	*dma_pos = 0;
+
+	// the dma engine is stopped so the buffers can be handed to another stream
+	release_buffers();
 }
 
 void UhdaStream::play(bool play) {
@@ -123,6 +187,14 @@ uint32_t UhdaStream::get_pos() const {
 	return *dma_pos;
 }
 
+void UhdaStream::flush([[maybe_unused]] uint32_t offset, [[maybe_unused]] uint32_t size) {
+#ifdef UHDA_KERNEL_HAS_MAP_TYPE
+	if (dma.buffer && dma.layout.map_type == UHDA_MAP_TYPE_CACHEABLE) {
+		uhda_kernel_flush_cache(static_cast<char*>(dma.buffer) + offset, size);
+	}
+#endif
+}
+
 void UhdaStream::output_irq() {
 	period_callback(this, period_callback_arg);
 	space.store(regs::stream::STS, sdsts::BCIS(true));
@@ -1,4 +1,5 @@
 #pragma once
+#include "dma_cache.hpp"
 #include "reg.hpp"
 #include "uhda/types.h"
 #include "spec.hpp"
@@ -8,25 +9,30 @@ struct UhdaStream {
 
 	UhdaStatus setup(const UhdaStreamParams* params);
 	void destroy();
+	// returns the dma buffers to the controller cache or frees them
+	void release_buffers();
 
 	void play(bool play);
 
 	[[nodiscard]] uint32_t get_pos() const;
 
+	// writes back the cpu caches of a part of a cacheable buffer
+	void flush(uint32_t offset, uint32_t size);
+
 	void output_irq();
 
 	uhda::MemSpace space {0};
-	uintptr_t bdl_phys {};
-	uhda::BufferDescriptor* bdl {};
-
-	UhdaScatterChunk* bdl_chunks {};
-	uint32_t bdl_chunk_count {};
-	uint32_t bdl_chunk_size {};
+	uhda::DmaBuffers dma {};
 	UhdaPeriodFn period_callback {};
 	void* period_callback_arg {};
 
 	volatile uint32_t* dma_pos {};
+	UhdaController* controller {};
+	// the state of the simple streams multiplexed onto this stream if it was allocated for them
+	void* mixer {};
 
 	uint8_t index {};
 	bool output {};
+	// handed out by `uhda_stream_alloc`
+	bool allocated {};
 };
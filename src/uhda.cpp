@@ -52,6 +52,30 @@ UhdaStatus uhda_init(void* pci_device, UhdaController** res) {
 	return UHDA_STATUS_SUCCESS;
 }
 
+UhdaStatus uhda_init_async(void* pci_device, UhdaInitFn fn, void* arg, UhdaController** res) {
+	auto ptr = uhda_kernel_malloc(sizeof(UhdaController));
+	if (!ptr) {
+		return UHDA_STATUS_NO_MEMORY;
+	}
+
+	auto* controller = uhda::construct<UhdaController>(ptr, pci_device);
+	auto status = controller->init_async(fn, arg);
+
+	if (status != UHDA_STATUS_SUCCESS) {
+		controller->~UhdaController();
+		uhda_kernel_free(ptr, sizeof(UhdaController));
+		return status;
+	}
+
+	*res = controller;
+
+	return UHDA_STATUS_SUCCESS;
+}
+
+bool uhda_init_poll(UhdaController* controller, uint32_t* delay_us) {
+	return controller->poll_init(*delay_us);
+}
+
 UhdaStatus uhda_destroy(UhdaController* controller) {
 	auto status = controller->destroy();
 	controller->~UhdaController();
@@ -72,6 +96,36 @@ void uhda_get_codecs(UhdaController* controller, const UhdaCodec* const** codecs
 	*codec_count = controller->codecs.size();
 }
 
+UhdaStatus uhda_set_verb_transport(UhdaController* controller, UhdaVerbTransport transport) {
+	return controller->set_verb_transport(transport);
+}
+
+UhdaStatus uhda_set_buffer_map_type(UhdaController* controller, UhdaMapType type) {
+	return controller->set_buffer_map_type(type);
+}
+
+UhdaStatus uhda_stream_alloc(UhdaController* controller, bool output, UhdaStream** res) {
+	auto streams = output ? controller->out_streams : controller->in_streams;
+	auto count = output ? controller->out_stream_count : controller->in_stream_count;
+
+	LockGuard guard {controller->lock};
+	for (uint8_t i = 0; i < count; ++i) {
+		if (!streams[i].allocated) {
+			streams[i].allocated = true;
+			*res = &streams[i];
+			return UHDA_STATUS_SUCCESS;
+		}
+	}
+
+	return UHDA_STATUS_NO_MEMORY;
+}
+
+void uhda_stream_free(UhdaStream* stream) {
+	LockGuard guard {stream->controller->lock};
+	stream->allocated = false;
+	stream->mixer = nullptr;
+}
+
 void uhda_get_output_streams(UhdaController* controller, UhdaStream*** streams, size_t* stream_count) {
 	*streams = controller->out_stream_ptrs;
 	*stream_count = controller->out_stream_count;
@@ -85,6 +139,24 @@ void uhda_codec_get_output_groups(
 	*output_group_count = codec->output_groups.size();
 }
 
+void uhda_codec_get_ids(const UhdaCodec* codec, uint32_t* vendor_id, uint32_t* revision_id) {
+	*vendor_id = codec->vendor_id;
+	*revision_id = codec->revision_id;
+}
+
+UhdaCodecStats uhda_codec_get_stats(const UhdaCodec* codec) {
+	LockGuard guard {codec->lock};
+	return codec->stats;
+}
+
+UhdaStatus uhda_codec_get_parameter(const UhdaCodec* codec, uint8_t nid, uint8_t param, uint32_t* res) {
+	return codec->get_parameter(nid, param, *res);
+}
+
+UhdaStatus uhda_codec_get_config_default(const UhdaCodec* codec, uint8_t nid, uint32_t* res) {
+	return codec->get_config_default(nid, *res);
+}
+
 void uhda_output_group_get_outputs(
 	const UhdaOutputGroup* output_group,
 	const UhdaOutput* const** outputs,
@@ -100,20 +172,73 @@ UhdaStatus uhda_output_get_presence(const UhdaOutput* output, bool* presence) {
 
 	auto codec = output->widget->codec;
 
-	if (output->widget->trigger) {
-		auto status = codec->set_pin_sense(output->widget->nid, 0);
-		if (status != UHDA_STATUS_SUCCESS) {
-			return status;
+	{
+		LockGuard guard {codec->lock};
+		if (codec->presence_cached(output)) {
+			*presence = output->presence;
+			return UHDA_STATUS_SUCCESS;
 		}
 	}
 
-	uint32_t value;
-	auto status = codec->get_pin_sense(output->widget->nid, value);
-	if (status != UHDA_STATUS_SUCCESS) {
-		return status;
+	return codec->update_presence(const_cast<UhdaOutput*>(output), *presence);
+}
+
+UhdaStatus uhda_outputs_get_presence(const UhdaOutput* const* outputs, size_t count, bool* presence) {
+	if (!count) {
+		return UHDA_STATUS_SUCCESS;
+	}
+
+	auto controller = outputs[0]->widget->codec->controller;
+	return controller->update_presence(const_cast<UhdaOutput* const*>(outputs), count, presence);
+}
+
+UhdaStatus uhda_codec_get_presence(const UhdaCodec* codec, bool* presence, size_t* count) {
+	size_t output_count = 0;
+	for (auto group : codec->output_groups) {
+		output_count += group->outputs.size();
 	}
 
-	*presence = value & 1 << 31;
+	if (*count < output_count) {
+		*count = output_count;
+		return UHDA_STATUS_NO_MEMORY;
+	}
+	*count = output_count;
+
+	// gather the outputs of all groups so they are queried together
+	UhdaOutput* outputs[32];
+	size_t pending = 0;
+	size_t offset = 0;
+	for (auto group : codec->output_groups) {
+		for (auto output : group->outputs) {
+			outputs[pending++] = output;
+			if (pending == sizeof(outputs) / sizeof(*outputs)) {
+				auto status = codec->controller->update_presence(outputs, pending, presence + offset);
+				if (status != UHDA_STATUS_SUCCESS) {
+					return status;
+				}
+				offset += pending;
+				pending = 0;
+			}
+		}
+	}
+
+	return codec->controller->update_presence(outputs, pending, presence + offset);
+}
+
+UhdaStatus uhda_poll_presence(UhdaController* controller) {
+	return controller->poll_presence();
+}
+
+UhdaStatus uhda_output_set_presence_callback(const UhdaOutput* output, UhdaPresenceFn fn, void* arg) {
+	if (!output->widget->presence_detect) {
+		return UHDA_STATUS_UNSUPPORTED;
+	}
+
+	auto mutable_output = const_cast<UhdaOutput*>(output);
+
+	LockGuard guard {output->widget->codec->lock};
+	mutable_output->presence_fn = fn;
+	mutable_output->presence_arg = arg;
 	return UHDA_STATUS_SUCCESS;
 }
 
@@ -227,8 +352,8 @@ bool uhda_paths_usable_simultaneously(const UhdaPath** paths, size_t count, bool
 	for (size_t i = 0; i < count; ++i) {
 		auto path = paths[i];
 
-		for (size_t widget_i = 1; widget_i < path->widgets.size(); ++widget_i) {
-			auto widget = path->widgets[widget_i];
+		for (size_t nid_i = 1; nid_i < path->length; ++nid_i) {
+			auto nid = path->nids[nid_i];
 
 			for (size_t j = 0; j < count; ++j) {
 				if (j == i) {
@@ -236,15 +361,19 @@ bool uhda_paths_usable_simultaneously(const UhdaPath** paths, size_t count, bool
 				}
 
 				auto other_path = paths[j];
-				for (size_t other_widget_i = 1; other_widget_i < other_path->widgets.size(); ++other_widget_i) {
-					auto other_widget = other_path->widgets[other_widget_i];
+				if (other_path->codec != path->codec) {
+					continue;
+				}
+
+				for (size_t other_nid_i = 1; other_nid_i < other_path->length; ++other_nid_i) {
+					auto other_nid = other_path->nids[other_nid_i];
 
-					if (path->widgets[widget_i - 1] == other_path->widgets[other_widget_i - 1]) {
+					if (path->nids[nid_i - 1] == other_path->nids[other_nid_i - 1]) {
 						if (!same_stream) {
 							return false;
 						}
 					}
-					else if (widget == other_widget) {
+					else if (nid == other_nid) {
 						return false;
 					}
 				}
@@ -263,7 +392,7 @@ UhdaStatus uhda_find_path(
 	UhdaPath** res) {
 	auto& all_paths = dest->widget->codec->output_paths;
 	for (auto& path : all_paths) {
-		if (path.widgets.front() == dest->widget) {
+		if (path.pin() == dest->widget->nid) {
 			bool not_usable = false;
 
 			for (size_t i = 0; i < other_path_count; ++i) {
@@ -288,130 +417,224 @@ UhdaStatus uhda_find_path(
 }
 
 UhdaPathInfo uhda_path_get_info(const UhdaPath* path) {
-	auto output = path->widgets.back();
+	auto codec = path->codec;
+	// the lists of all paths were decoded during enumeration and aren't modified afterwards
+	auto decoded = codec->find_caps(codec->path_supported_rates(*path));
+	if (!decoded) {
+		return {};
+	}
 
 	UhdaPathInfo info {
-		.supported_sample_rates = output->supported_sample_rates.data(),
-		.supported_sample_rate_count = static_cast<uint32_t>(output->supported_sample_rates.size()),
-		.supported_formats = output->supported_formats.data(),
-		.supported_formats_count = static_cast<uint32_t>(output->supported_formats.size())
+		.supported_sample_rates = decoded->sample_rates,
+		.supported_sample_rate_count = decoded->sample_rate_count,
+		.supported_formats = decoded->formats,
+		.supported_formats_count = decoded->format_count
 	};
 
 	return info;
 }
 
-UhdaStatus uhda_path_setup(UhdaPath* path, UhdaStreamParams* params, UhdaStream* stream) {
-	if (!stream->output || !uhda_check_stream_params(params)) {
-		return UHDA_STATUS_UNSUPPORTED;
-	}
+UhdaPathCaps uhda_path_get_caps(const UhdaPath* path) {
+	uint32_t supported = path->codec->path_supported_rates(*path);
 
-	auto fmt = pcm_format_from_params(params->sample_rate, params->channels, params->fmt);
+	return {
+		.rates = supported & 0x7FF,
+		.formats = supported >> 16 & 0x1F
+	};
+}
 
-	auto output = path->widgets.back();
-	if (output->type != widget_type::AUDIO_OUT) {
-		return UHDA_STATUS_UNSUPPORTED;
+uint32_t uhda_rate_bit(uint32_t sample_rate) {
+	switch (sample_rate) {
+		case 8000:
+			return UHDA_RATE_8000;
+		case 11025:
+			return UHDA_RATE_11025;
+		case 16000:
+			return UHDA_RATE_16000;
+		case 22050:
+			return UHDA_RATE_22050;
+		case 32000:
+			return UHDA_RATE_32000;
+		case 44100:
+			return UHDA_RATE_44100;
+		case 48000:
+			return UHDA_RATE_48000;
+		case 88200:
+			return UHDA_RATE_88200;
+		case 96000:
+			return UHDA_RATE_96000;
+		case 176400:
+			return UHDA_RATE_176400;
+		case 192000:
+			return UHDA_RATE_192000;
+		default:
+			return 0;
 	}
+}
 
-	auto codec = path->codec;
+namespace {
+	// sets up a path to play the two channels starting from `channel` of the stream
+	UhdaStatus setup_path(UhdaPath* path, PcmFormat fmt, UhdaStream* stream, uint8_t channel) {
+		auto codec = path->codec;
+		auto output_nid = path->converter();
+		if (codec->widget_types[output_nid] != widget_type::AUDIO_OUT) {
+			return UHDA_STATUS_UNSUPPORTED;
+		}
 
-	auto status = codec->set_converter_format(output->nid, fmt.value);
-	if (status != UHDA_STATUS_SUCCESS) {
-		return status;
-	}
+		auto status = codec->set_converter_format(output_nid, fmt.value);
+		if (status != UHDA_STATUS_SUCCESS) {
+			return status;
+		}
 
-	status = codec->set_converter_channel_count(output->nid, fmt.value & pcm_format::CHAN);
-	if (status != UHDA_STATUS_SUCCESS) {
-		return status;
-	}
+		// the converter only takes as many channels as it has from the ones after its offset
+		uint8_t stream_channels = (fmt.value & pcm_format::CHAN) + 1;
+		uint8_t converter_channels = codec->widgets[output_nid].channels;
+		if (converter_channels > stream_channels - channel) {
+			converter_channels = stream_channels - channel;
+		}
 
-	for (size_t i = 0; i < path->widgets.size(); ++i) {
-		auto widget = path->widgets[i];
+		status = codec->set_converter_channel_count(output_nid, converter_channels - 1);
+		if (status != UHDA_STATUS_SUCCESS) {
+			return status;
+		}
 
-		if (i != path->widgets.size() - 1 && widget->connections.size() > 1) {
-			auto next_widget = path->widgets[i + 1];
+		for (size_t i = 0; i < path->length; ++i) {
+			auto nid = path->nids[i];
+			auto type = codec->widget_types[nid];
+			auto& widget = codec->widgets[nid];
 
-			size_t index = 0;
-			for (size_t j = 0; j < widget->connections.size(); ++j) {
-				auto connection = widget->connections[j];
-				if (connection & 1 << 7) {
-					auto start = widget->connections[j - 1];
-					auto end = connection & 0x7F;
-					if (next_widget->nid >= start && next_widget->nid <= end) {
-						index += next_widget->nid - start;
-						break;
-					}
-					index += end - start;
-				}
-				else {
-					if (next_widget->nid == connection) {
-						break;
-					}
+			auto con_count = codec->connection_count(nid);
+			if (i != path->length - 1U && con_count > 1) {
+				auto next_nid = path->nids[i + 1];
+				auto cons = codec->connections(nid);
+
+				uint8_t index = 0;
+				while (index < con_count && cons[index] != next_nid) {
 					++index;
 				}
+
+				status = codec->set_selected_connection(nid, index);
+				if (status != UHDA_STATUS_SUCCESS) {
+					return status;
+				}
 			}
 
-			status = codec->set_selected_connection(widget->nid, index);
+			status = codec->set_power_state(nid, 0);
 			if (status != UHDA_STATUS_SUCCESS) {
 				return status;
 			}
-		}
 
-		status = codec->set_power_state(widget->nid, 0);
-		if (status != UHDA_STATUS_SUCCESS) {
-			return status;
-		}
+			if (type == widget_type::PIN_COMPLEX) {
+				if (widget.pin_caps & 1 << 16) {
+					status = codec->set_eapd_enable(nid, 1 << 1);
+					if (status != UHDA_STATUS_SUCCESS) {
+						return status;
+					}
+				}
+
+				uint8_t step = widget.out_amp_caps & 0x7F;
 
-		if (widget->type == widget_type::PIN_COMPLEX) {
-			if (widget->pin_caps & 1 << 16) {
-				status = codec->set_eapd_enable(widget->nid, 1 << 1);
+				// set output amp, set left amp, set right amp and gain
+				uint16_t amp_data = 1 << 15 | 1 << 13 | 1 << 12 | step;
+				status = codec->set_amp_gain_mute(nid, amp_data);
 				if (status != UHDA_STATUS_SUCCESS) {
 					return status;
 				}
-			}
 
-			uint8_t step = widget->out_amp_caps & 0x7F;
+				// headphone amp, out enable
+				uint8_t pin_control = 1 << 7 | 1 << 6;
+				status = codec->set_pin_control(nid, pin_control);
+				if (status != UHDA_STATUS_SUCCESS) {
+					return status;
+				}
+			}
+			else if (type == widget_type::AUDIO_MIXER) {
+				uint8_t step = widget.out_amp_caps & 0x7F;
 
-			// set output amp, set left amp, set right amp and gain
-			uint16_t amp_data = 1 << 15 | 1 << 13 | 1 << 12 | step;
-			status = codec->set_amp_gain_mute(widget->nid, amp_data);
-			if (status != UHDA_STATUS_SUCCESS) {
-				return status;
+				// set output amp, set left amp, set right amp and gain
+				uint16_t amp_data = 1 << 15 | 1 << 13 | 1 << 12 | step;
+				status = codec->set_amp_gain_mute(nid, amp_data);
+				if (status != UHDA_STATUS_SUCCESS) {
+					return status;
+				}
 			}
+			else if (type == widget_type::AUDIO_OUT) {
+				status = codec->set_converter_control(nid, stream->index + 1, channel);
+				if (status != UHDA_STATUS_SUCCESS) {
+					return status;
+				}
 
-			// headphone amp, out enable
-			uint8_t pin_control = 1 << 7 | 1 << 6;
-			status = codec->set_pin_control(widget->nid, pin_control);
-			if (status != UHDA_STATUS_SUCCESS) {
-				return status;
+				uint8_t step = widget.out_amp_caps & 0x7F;
+
+				// set output amp, set left amp, set right amp and gain
+				uint16_t amp_data = 1 << 15 | 1 << 13 | 1 << 12 | (step / 2);
+
+				path->gain = step / 2;
+
+				status = codec->set_amp_gain_mute(nid, amp_data);
+				if (status != UHDA_STATUS_SUCCESS) {
+					return status;
+				}
 			}
 		}
-		else if (widget->type == widget_type::AUDIO_MIXER) {
-			uint8_t step = widget->out_amp_caps & 0x7F;
 
-			// set output amp, set left amp, set right amp and gain
-			uint16_t amp_data = 1 << 15 | 1 << 13 | 1 << 12 | step;
-			status = codec->set_amp_gain_mute(widget->nid, amp_data);
-			if (status != UHDA_STATUS_SUCCESS) {
-				return status;
-			}
+		return UHDA_STATUS_SUCCESS;
+	}
+}
+
+UhdaStatus uhda_path_setup(UhdaPath* path, UhdaStreamParams* params, UhdaStream* stream) {
+	if (!stream->output || !uhda_check_stream_params(params)) {
+		return UHDA_STATUS_UNSUPPORTED;
+	}
+
+	auto fmt = pcm_format_from_params(params->sample_rate, params->channels, params->fmt);
+	return setup_path(path, fmt, stream, 0);
+}
+
+UhdaStatus uhda_output_group_find_paths(const UhdaOutputGroup* group, UhdaPath** paths, size_t* path_count) {
+	size_t count = 0;
+	for (auto output : group->outputs) {
+		// sequence 0xF in a group is a headphone jack sharing the group instead of a channel pair
+		if (output->sequence == 0xF && group->outputs.size() > 1) {
+			continue;
 		}
-		else if (widget->type == widget_type::AUDIO_OUT) {
-			status = codec->set_converter_control(widget->nid, stream->index + 1, 0);
-			if (status != UHDA_STATUS_SUCCESS) {
-				return status;
-			}
 
-			uint8_t step = widget->out_amp_caps & 0x7F;
+		// every output needs its own converter to get its own channels
+		auto status = uhda_find_path(
+			output,
+			const_cast<const UhdaPath**>(paths),
+			count,
+			false,
+			&paths[count]);
+		if (status != UHDA_STATUS_SUCCESS) {
+			return status;
+		}
+		++count;
+	}
 
-			// set output amp, set left amp, set right amp and gain
-			uint16_t amp_data = 1 << 15 | 1 << 13 | 1 << 12 | (step / 2);
+	*path_count = count;
+	return UHDA_STATUS_SUCCESS;
+}
 
-			path->gain = step / 2;
+UhdaStatus uhda_paths_setup_multichannel(
+	UhdaPath** paths,
+	size_t path_count,
+	UhdaStreamParams* params,
+	UhdaStream* stream) {
+	if (!stream->output || !path_count || !uhda_check_stream_params(params)) {
+		return UHDA_STATUS_UNSUPPORTED;
+	}
 
-			status = codec->set_amp_gain_mute(widget->nid, amp_data);
-			if (status != UHDA_STATUS_SUCCESS) {
-				return status;
-			}
+	// every path has to get at least one channel
+	if (params->channels <= 2 * (path_count - 1)) {
+		return UHDA_STATUS_UNSUPPORTED;
+	}
+
+	auto fmt = pcm_format_from_params(params->sample_rate, params->channels, params->fmt);
+	for (size_t i = 0; i < path_count; ++i) {
+		auto status = setup_path(paths[i], fmt, stream, 2 * i);
+		if (status != UHDA_STATUS_SUCCESS) {
+			return status;
 		}
 	}
 
@@ -421,30 +644,33 @@ UhdaStatus uhda_path_setup(UhdaPath* path, UhdaStreamParams* params, UhdaStream*
 UhdaStatus uhda_path_shutdown(UhdaPath* path) {
 	auto codec = path->codec;
 
-	for (auto widget : path->widgets) {
-		if (widget->type == widget_type::PIN_COMPLEX) {
+	for (size_t i = 0; i < path->length; ++i) {
+		auto nid = path->nids[i];
+		auto type = codec->widget_types[nid];
+
+		if (type == widget_type::PIN_COMPLEX) {
 			// set output amp, set left amp, set right amp and mute
 			uint16_t amp_data = 1 << 15 | 1 << 13 | 1 << 12 | 1 << 7;
-			auto status = codec->set_amp_gain_mute(widget->nid, amp_data);
+			auto status = codec->set_amp_gain_mute(nid, amp_data);
 			if (status != UHDA_STATUS_SUCCESS) {
 				return status;
 			}
 
-			status = codec->set_pin_control(widget->nid, 0);
+			status = codec->set_pin_control(nid, 0);
 			if (status != UHDA_STATUS_SUCCESS) {
 				return status;
 			}
 		}
-		else if (widget->type == widget_type::AUDIO_MIXER) {
+		else if (type == widget_type::AUDIO_MIXER) {
 			// set output amp, set left amp, set right amp and mute
 			uint16_t amp_data = 1 << 15 | 1 << 13 | 1 << 12 | 1 << 7;
-			auto status = codec->set_amp_gain_mute(widget->nid, amp_data);
+			auto status = codec->set_amp_gain_mute(nid, amp_data);
 			if (status != UHDA_STATUS_SUCCESS) {
 				return status;
 			}
 		}
-		else if (widget->type == widget_type::AUDIO_OUT) {
-			auto status = codec->set_converter_control(widget->nid, 0, 0);
+		else if (type == widget_type::AUDIO_OUT) {
+			auto status = codec->set_converter_control(nid, 0, 0);
 			if (status != UHDA_STATUS_SUCCESS) {
 				return status;
 			}
@@ -462,12 +688,13 @@ UhdaStatus uhda_path_set_volume(UhdaPath* path, int volume) {
 		volume = 100;
 	}
 
-	auto output = path->widgets.back();
-	if (output->type != widget_type::AUDIO_OUT) {
+	auto codec = path->codec;
+	auto output_nid = path->converter();
+	if (codec->widget_types[output_nid] != widget_type::AUDIO_OUT) {
 		return UHDA_STATUS_UNSUPPORTED;
 	}
 
-	uint8_t max_value = output->out_amp_caps & 0x7F;
+	uint8_t max_value = codec->widgets[output_nid].out_amp_caps & 0x7F;
 
 	// do the volume calculation in 16.16 fixed point format
 
@@ -493,25 +720,26 @@ UhdaStatus uhda_path_set_volume(UhdaPath* path, int volume) {
 
 	// set output amp, set left amp, set right amp and gain
 	uint16_t amp_data = 1 << 15 | 1 << 13 | 1 << 12 | value;
-	return path->codec->set_amp_gain_mute(output->nid, amp_data);
+	return codec->set_amp_gain_mute(output_nid, amp_data);
 }
 
 UhdaStatus uhda_path_mute(UhdaPath* path, bool mute) {
-	auto pin = path->widgets.front();
+	auto codec = path->codec;
+	auto pin_nid = path->pin();
 
-	UhdaWidget* mute_widget;
+	uint8_t mute_nid;
 
 	// bit 31 == mute supported
-	if (pin->out_amp_caps & 1 << 31) {
-		mute_widget = pin;
+	if (codec->widgets[pin_nid].out_amp_caps & 1 << 31) {
+		mute_nid = pin_nid;
 	}
 	else {
-		mute_widget = path->widgets.back();
+		mute_nid = path->converter();
 	}
 
 	// set output amp, set left amp, set right amp, mute and gain
 	uint16_t amp_data = 1 << 15 | 1 << 13 | 1 << 12 | (mute ? (1 << 7) : 0) | path->gain;
-	return path->codec->set_amp_gain_mute(mute_widget->nid, amp_data);
+	return codec->set_amp_gain_mute(mute_nid, amp_data);
 }
 
 bool uhda_check_stream_params(const UhdaStreamParams* params) {
@@ -533,6 +761,21 @@ bool uhda_check_stream_params(const UhdaStreamParams* params) {
 		return false;
 	}
 
+	if (params->contiguous && params->period_size % UHDA_CONTIGUOUS_PERIOD_SIZE_ALIGNMENT != 0) {
+		return false;
+	}
+
+	if (!params->contiguous && params->chunk_size && params->chunk_size < params->period_size) {
+		if (params->chunk_size % UHDA_CHUNK_SIZE_ALIGNMENT != 0) {
+			return false;
+		}
+
+		uint32_t chunks_per_period = (params->period_size + params->chunk_size - 1) / params->chunk_size;
+		if (chunks_per_period > UHDA_MAX_CHUNKS / params->period_count) {
+			return false;
+		}
+	}
+
 	if (params->period_callback_distance < UHDA_MIN_PERIOD_CALLBACK_DISTANCE ||
 		params->period_callback_distance > params->period_count) {
 
@@ -569,7 +812,7 @@ UhdaStatus uhda_stream_play(UhdaStream* stream, bool play) {
 }
 
 UhdaStreamStatus uhda_stream_get_status(const UhdaStream* stream) {
-	if (!stream->bdl_chunks) {
+	if (!stream->dma.chunks) {
 		return UHDA_STREAM_STATUS_UNINITIALIZED;
 	}
 
@@ -583,7 +826,7 @@ UhdaStreamStatus uhda_stream_get_status(const UhdaStream* stream) {
 }
 
 uint32_t uhda_stream_get_ctrl_headroom(const UhdaStream* stream) {
-	if (!stream->bdl_chunks) {
+	if (!stream->dma.chunks) {
 		return 0;
 	}
 
@@ -601,10 +844,40 @@ uint32_t uhda_stream_get_position(const UhdaStream* stream) {
 }
 
 UhdaStatus uhda_stream_get_periods(UhdaStream* stream, const UhdaScatterChunk** chunks) {
-	if (!stream->bdl_chunks) {
+	if (!stream->dma.chunks || stream->dma.layout.chunks_per_period() != 1) {
+		return UHDA_STATUS_UNSUPPORTED;
+	}
+
+	*chunks = stream->dma.chunks;
+	return UHDA_STATUS_SUCCESS;
+}
+
+UhdaStatus uhda_stream_get_chunks(
+	UhdaStream* stream,
+	const UhdaScatterChunk** chunks,
+	uint32_t* chunk_count,
+	uint32_t* chunk_size) {
+	if (!stream->dma.chunks) {
+		return UHDA_STATUS_UNSUPPORTED;
+	}
+
+	*chunks = stream->dma.chunks;
+	*chunk_count = stream->dma.layout.chunk_count();
+	*chunk_size = stream->dma.layout.chunk_size;
+	return UHDA_STATUS_SUCCESS;
+}
+
+void uhda_stream_flush(UhdaStream* stream, uint32_t offset, uint32_t size) {
+	stream->flush(offset, size);
+}
+
+UhdaStatus uhda_stream_get_buffer(UhdaStream* stream, UhdaScatterChunk* buffer, uint32_t* size) {
+	if (!stream->dma.chunks || !stream->dma.buffer_phys) {
 		return UHDA_STATUS_UNSUPPORTED;
 	}
 
-	*chunks = stream->bdl_chunks;
+	buffer->phys = stream->dma.buffer_phys;
+	buffer->virt = stream->dma.buffer;
+	*size = stream->dma.layout.buffer_size();
 	return UHDA_STATUS_SUCCESS;
 }
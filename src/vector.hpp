@@ -3,107 +3,143 @@
 #include "utils.hpp"
 
 namespace uhda {
-	template<typename T>
-	class vector {
-	public:
-		vector() = default;
+	struct KernelAllocator {
+		static constexpr bool RELEASES_IN_BULK = false;
 
-		vector(const vector&) = delete;
-		vector& operator=(const vector&) = delete;
+		void* allocate(size_t size, size_t) {
+			return uhda_kernel_malloc(size);
+		}
 
-		vector(vector&& other) noexcept : ptr {other.ptr}, _size {other._size}, cap {other.cap} {
-			other.ptr = nullptr;
-			other._size = 0;
-			other.cap = 0;
+		void deallocate(void* ptr, size_t size) {
+			uhda_kernel_free(ptr, size);
 		}
 
-		vector& operator=(vector&& other) noexcept {
-			if (ptr) {
-				for (size_t i = 0; i < _size; ++i) {
-					ptr[i].~T();
-				}
+		bool extend(void*, size_t, size_t) {
+			return false;
+		}
+	};
 
-				uhda_kernel_free(ptr, cap * sizeof(T));
+	namespace detail {
+		template<typename T, size_t N>
+		struct InlineStorage {
+			T* get() {
+				return reinterpret_cast<T*>(storage);
 			}
 
-			ptr = other.ptr;
-			_size = other._size;
-			cap = other.cap;
-			other.ptr = nullptr;
-			other._size = 0;
-			other.cap = 0;
+			alignas(T) unsigned char storage[N * sizeof(T)];
+		};
+
+		template<typename T>
+		struct InlineStorage<T, 0> {
+			T* get() {
+				return nullptr;
+			}
+		};
+	}
+
+	/*
+	 * A vector that stores up to `N` elements inline and only allocates once it grows beyond that.
+	 */
+	template<typename T, size_t N, typename A = KernelAllocator>
+	class small_vector {
+	public:
+		constexpr small_vector() = default;
+
+		constexpr small_vector(A alloc) : alloc {alloc} {}
+
+		small_vector(const small_vector&) = delete;
+		small_vector& operator=(const small_vector&) = delete;
+
+		small_vector(small_vector&& other) noexcept {
+			take(other);
+		}
+
+		small_vector& operator=(small_vector&& other) noexcept {
+			if (this != &other) {
+				clear();
+				free_storage();
+				take(other);
+			}
 			return *this;
 		}
 
-		~vector() {
-			for (size_t i = 0; i < _size; ++i) {
-				ptr[i].~T();
+		~small_vector() {
+			if constexpr (!A::RELEASES_IN_BULK) {
+				clear();
+				free_storage();
 			}
-			uhda_kernel_free(ptr, cap * sizeof(T));
 		}
 
 		[[nodiscard]] bool push(T value) {
-			if (!ensure_space()) {
+			if (!ensure_space(1)) {
 				return false;
 			}
 
-			construct<T>(&ptr[_size++], move(value));
+			construct<T>(&data()[_size++], move(value));
+			return true;
+		}
+
+		/*
+		 * Appends `count` elements copied from `values`.
+		 */
+		[[nodiscard]] bool append(const T* values, size_t count) {
+			if (!ensure_space(count)) {
+				return false;
+			}
+
+			auto* elems = data();
+			for (size_t i = 0; i < count; ++i) {
+				construct<T>(&elems[_size++], values[i]);
+			}
 			return true;
 		}
 
 		[[nodiscard]] bool insert(T* pos, T value) {
 			if (!pos) {
-				pos = ptr;
+				pos = data();
 			}
 
-			size_t index = pos - ptr;
+			size_t index = pos - data();
 
-			if (!ensure_space()) {
+			if (!ensure_space(1)) {
 				return false;
 			}
 
-			construct<T>(&ptr[_size++]);
+			auto* elems = data();
+			construct<T>(&elems[_size++]);
 
 			for (size_t i = _size - 1; i > index; --i) {
-				ptr[i] = move(ptr[i - 1]);
+				elems[i] = move(elems[i - 1]);
 			}
 
-			ptr[index] = move(value);
+			elems[index] = move(value);
 
 			return true;
 		}
 
+		/*
+		 * Makes sure that at least `new_cap` elements fit without reallocating.
+		 */
+		[[nodiscard]] bool reserve(size_t new_cap) {
+			if (new_cap <= cap) {
+				return true;
+			}
+			return reallocate(new_cap);
+		}
+
 		[[nodiscard]] bool resize(size_t new_size) {
 			if (new_size <= _size) {
 				for (size_t i = new_size; i < _size; ++i) {
-					ptr[i].~T();
+					data()[i].~T();
 				}
 			}
 			else {
-				if (new_size <= cap) {
-					for (size_t i = _size; i < new_size; ++i) {
-						construct<T>(&ptr[i]);
-					}
+				if (!reserve(new_size)) {
+					return false;
 				}
-				else {
-					auto* new_ptr = static_cast<T*>(uhda_kernel_malloc(new_size * sizeof(T)));
-					if (!new_ptr) {
-						return false;
-					}
-
-					for (size_t i = 0; i < _size; ++i) {
-						construct<T>(&new_ptr[i], move(ptr[i]));
-						ptr[i].~T();
-					}
-
-					uhda_kernel_free(ptr, cap * sizeof(T));
-
-					ptr = new_ptr;
-					cap = new_size;
 
-					for (size_t i = _size; i < new_size; ++i) {
-						construct<T>(&new_ptr[i]);
-					}
+				for (size_t i = _size; i < new_size; ++i) {
+					construct<T>(&data()[i]);
 				}
 			}
 
@@ -112,80 +148,148 @@ namespace uhda {
 		}
 
 		void pop() {
-			ptr[--_size].~T();
+			data()[--_size].~T();
+		}
+
+		void clear() {
+			for (size_t i = 0; i < _size; ++i) {
+				data()[i].~T();
+			}
+			_size = 0;
 		}
 
-		constexpr T* begin() {
-			return ptr;
+		T* begin() {
+			return data();
 		}
 
-		constexpr const T* begin() const {
-			return ptr;
+		const T* begin() const {
+			return data();
 		}
 
-		constexpr T* end() {
-			return ptr + _size;
+		T* end() {
+			return data() + _size;
 		}
 
-		constexpr const T* end() const {
-			return ptr + _size;
+		const T* end() const {
+			return data() + _size;
 		}
 
-		constexpr T* data() {
-			return ptr;
+		T* data() {
+			if constexpr (N == 0) {
+				return ptr;
+			}
+			else {
+				return ptr ? ptr : inline_storage.get();
+			}
+		}
+
+		const T* data() const {
+			return const_cast<small_vector*>(this)->data();
 		}
 
-		constexpr const T* data() const {
-			return ptr;
+		T& operator[](size_t index) {
+			return data()[index];
 		}
 
-		constexpr T& operator[](size_t index) {
-			return ptr[index];
+		const T& operator[](size_t index) const {
+			return data()[index];
 		}
 
-		constexpr const T& operator[](size_t index) const {
-			return ptr[index];
+		T& front() {
+			return data()[0];
 		}
 
-		constexpr T& front() {
-			return ptr[0];
+		const T& front() const {
+			return data()[0];
 		}
 
-		constexpr T& back() {
-			return ptr[_size - 1];
+		T& back() {
+			return data()[_size - 1];
 		}
 
-		constexpr const T& back() const {
-			return ptr[_size - 1];
+		const T& back() const {
+			return data()[_size - 1];
 		}
 
 		[[nodiscard]] constexpr size_t size() const {
 			return _size;
 		}
 
+		[[nodiscard]] constexpr size_t capacity() const {
+			return cap;
+		}
+
 		[[nodiscard]] constexpr bool is_empty() const {
 			return !_size;
 		}
 
 	private:
-		bool ensure_space() {
-			if (_size == cap) {
-				auto new_cap = cap < 8 ? 8 : cap + cap / 2;
+		// elements are stored inline while `ptr` is null
+		void free_storage() {
+			if (ptr) {
+				alloc.deallocate(ptr, cap * sizeof(T));
+			}
+			ptr = nullptr;
+			cap = N;
+		}
 
-				auto* new_ptr = static_cast<T*>(uhda_kernel_malloc(new_cap * sizeof(T)));
-				if (!new_ptr) {
-					return false;
-				}
+		void take(small_vector& other) {
+			alloc = other.alloc;
 
-				for (size_t i = 0; i < _size; ++i) {
-					construct<T>(&new_ptr[i], move(ptr[i]));
-					ptr[i].~T();
+			if (!other.ptr) {
+				auto* elems = data();
+				auto* other_elems = other.data();
+				for (size_t i = 0; i < other._size; ++i) {
+					construct<T>(&elems[i], move(other_elems[i]));
+					other_elems[i].~T();
 				}
+				_size = other._size;
+			}
+			else {
+				ptr = other.ptr;
+				_size = other._size;
+				cap = other.cap;
+				other.ptr = nullptr;
+				other.cap = N;
+			}
 
-				uhda_kernel_free(ptr, cap * sizeof(T));
+			other._size = 0;
+		}
 
-				ptr = new_ptr;
+		bool reallocate(size_t new_cap) {
+			if (ptr && alloc.extend(ptr, cap * sizeof(T), new_cap * sizeof(T))) {
 				cap = new_cap;
+				return true;
+			}
+
+			auto* new_ptr = static_cast<T*>(alloc.allocate(new_cap * sizeof(T), alignof(T)));
+			if (!new_ptr) {
+				return false;
+			}
+
+			auto* elems = data();
+			for (size_t i = 0; i < _size; ++i) {
+				construct<T>(&new_ptr[i], move(elems[i]));
+				elems[i].~T();
+			}
+
+			if (ptr) {
+				alloc.deallocate(ptr, cap * sizeof(T));
+			}
+
+			ptr = new_ptr;
+			cap = new_cap;
+			return true;
+		}
+
+		bool ensure_space(size_t count) {
+			if (_size + count > cap) {
+				auto new_cap = cap < 8 ? 8 : cap + cap / 2;
+				if (new_cap < _size + count) {
+					new_cap = _size + count;
+				}
+
+				return reallocate(new_cap);
 			}
 
 			return true;
@@ -193,6 +297,11 @@ namespace uhda {
 
 		T* ptr {};
 		size_t _size {};
-		size_t cap {};
+		size_t cap {N};
+		[[no_unique_address]] A alloc {};
+		[[no_unique_address]] detail::InlineStorage<T, N> inline_storage {};
 	};
+
+	template<typename T>
+	using vector = small_vector<T, 0>;
 }
@@ -0,0 +1,82 @@
+#pragma once
+#include "uhda/kernel_api.h"
+
+namespace uhda {
+	/*
+	 * Waits for at least `microseconds`, giving the cpu away if the kernel provides `uhda_kernel_sleep`.
+	 *
+	 * Note: must not be called while holding a spinlock.
+	 */
+	inline void sleep(uint32_t microseconds) {
+#ifdef UHDA_KERNEL_HAS_SLEEP
+		uhda_kernel_sleep(microseconds);
+#else
+		uhda_kernel_delay(microseconds);
+#endif
+	}
+
+	/*
+	 * A timeout that is measured in real time if the kernel provides `uhda_kernel_get_nanoseconds`,
+	 * otherwise only the time waited through it counts and every poll counts as a microsecond.
+	 */
+	class Deadline {
+	public:
+		// an already expired deadline
+		constexpr Deadline() = default;
+
+		explicit Deadline(uint32_t timeout_us) {
+#ifdef UHDA_KERNEL_HAS_CLOCK
+			end = uhda_kernel_get_nanoseconds() + static_cast<uint64_t>(timeout_us) * 1000;
+#else
+			remaining = timeout_us;
+#endif
+		}
+
+		[[nodiscard]] bool expired() const {
+#ifdef UHDA_KERNEL_HAS_CLOCK
+			return uhda_kernel_get_nanoseconds() >= end;
+#else
+			return !remaining;
+#endif
+		}
+
+		/*
+		 * Busy-waits for `microseconds`, usable while holding a spinlock.
+		 */
+		void delay(uint32_t microseconds) {
+			uhda_kernel_delay(microseconds);
+			elapse(microseconds);
+		}
+
+		/*
+		 * Waits for at least `microseconds` using `uhda::sleep`.
+		 */
+		void sleep(uint32_t microseconds) {
+			uhda::sleep(microseconds);
+			elapse(microseconds);
+		}
+
+		/*
+		 * Marks a poll that doesn't wait in between.
+		 */
+		void poll() {
+			elapse(1);
+		}
+
+		/*
+		 * Marks `microseconds` as waited outside of the deadline, e.g. by the caller of a state machine.
+		 */
+		void elapse([[maybe_unused]] uint32_t microseconds) {
+#ifndef UHDA_KERNEL_HAS_CLOCK
+			remaining = remaining > microseconds ? remaining - microseconds : 0;
+#endif
+		}
+
+	private:
+#ifdef UHDA_KERNEL_HAS_CLOCK
+		uint64_t end {};
+#else
+		uint32_t remaining {};
+#endif
+	};
+}
@@ -1,21 +1,44 @@
 #pragma once
+#include "arena.hpp"
 #include "vector.hpp"
 
 struct UhdaCodec;
 
+/*
+ * Per-widget data that is only needed when setting up paths and querying outputs,
+ * the types and connections used while walking the graph are kept in the codec.
+ */
 struct UhdaWidget {
 	UhdaCodec* codec;
-	uhda::vector<uint8_t> connections;
-	uhda::vector<uint32_t> supported_sample_rates;
-	uhda::vector<UhdaFormat> supported_formats;
 	uint32_t in_amp_caps;
 	uint32_t out_amp_caps;
 	uint32_t pin_caps;
 	uint32_t default_config;
+	// the raw SUPPORTED_RATES parameter, converters without their own use the function group's
 	uint32_t supported_rates;
 	uint8_t nid;
-	uint8_t type;
 	uint8_t default_dev;
+	// the amount of channels a converter handles
+	uint8_t channels;
 	bool trigger : 1;
 	bool presence_detect : 1;
+	bool unsol_capable : 1;
+};
+
+/*
+ * The last values written to the controls of a widget, used to drop verbs that wouldn't change anything.
+ */
+struct UhdaWidgetState {
+	// the control hasn't been written yet or the write failed
+	static constexpr uint16_t UNKNOWN = 0xFFFF;
+
+	// left and right output amp mute and gain
+	uint16_t out_amp[2] {UNKNOWN, UNKNOWN};
+	uint16_t conn_select {UNKNOWN};
+	uint16_t power_state {UNKNOWN};
+	uint16_t pin_control {UNKNOWN};
+	uint16_t eapd {UNKNOWN};
+	uint16_t converter_format {UNKNOWN};
+	uint16_t converter_control {UNKNOWN};
+	uint16_t converter_channel_count {UNKNOWN};
 };
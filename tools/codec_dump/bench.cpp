@@ -0,0 +1,303 @@
+#include "controller.hpp"
+#include "dump.hpp"
+#include "emulator.hpp"
+#include "lock_guard.hpp"
+#include "uhda/simple.h"
+#include "uhda/uhda.h"
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+/*
+ * Benchmarks codec enumeration on codec graphs loaded from Linux codec dumps.
+ *
+ * Usage: codec-bench [-n iterations] [--no-delays] dump...
+ * Each dump is attached to the emulated controller at the next codec address.
+ */
+
+namespace {
+	using Clock = std::chrono::steady_clock;
+
+	double to_us(Clock::duration duration) {
+		return std::chrono::duration<double, std::micro>(duration).count();
+	}
+
+	struct Timing {
+		double total {};
+		double min {1e30};
+		double max {};
+
+		void add(double value) {
+			total += value;
+			if (value < min) {
+				min = value;
+			}
+			if (value > max) {
+				max = value;
+			}
+		}
+	};
+
+	void print_timing(const char* name, const Timing& timing, uint32_t iterations) {
+		printf("%-20s avg %10.2f us  min %10.2f us  max %10.2f us\n",
+			name, timing.total / iterations, timing.min, timing.max);
+	}
+
+	constexpr uint32_t LATENCY_VERBS = 64;
+
+	// times single uncached verbs sent to the first codec using the given transport
+	bool time_verbs(UhdaController* controller, UhdaVerbTransport transport, Timing& timing) {
+		if (uhda_set_verb_transport(controller, transport) != UHDA_STATUS_SUCCESS) {
+			return false;
+		}
+
+		auto codec = controller->codecs[0];
+		for (uint32_t i = 0; i < LATENCY_VERBS; ++i) {
+			uint32_t res;
+			auto start = Clock::now();
+			UhdaStatus status;
+			{
+				uhda::LockGuard guard {codec->lock};
+				status = codec->send_verb(0, uhda::cmd::GET_PARAM, uhda::param::VENDOR_ID, res);
+			}
+			auto end = Clock::now();
+			if (status != UHDA_STATUS_SUCCESS) {
+				return false;
+			}
+			timing.add(to_us(end - start));
+		}
+
+		return uhda_set_verb_transport(controller, UHDA_VERB_TRANSPORT_RINGS) == UHDA_STATUS_SUCCESS;
+	}
+
+	constexpr uint32_t COPY_SIZE = 0x10000;
+	constexpr uint32_t COPY_ROUNDS = 16;
+
+	/*
+	 * Times the simple stream copying `COPY_SIZE` bytes from its ring into the dma buffer,
+	 * the emulated controller has no dma so the position is advanced and the period callback is called by hand.
+	 * Note: host memory is always cached, so this measures the copy path and not the gain of the mapping type.
+	 */
+	bool time_copy(UhdaController* controller, Timing& timing) {
+		UhdaSimpleStreamParams params {
+			.sample_rate = 48000,
+			.channels = 2,
+			.fmt = UHDA_FORMAT_PCM16,
+			.ring_buffer_size = COPY_SIZE
+		};
+		UhdaSimpleStream* stream;
+		if (uhda_simple_stream_alloc(controller, &params, &stream) != UHDA_STATUS_SUCCESS) {
+			return false;
+		}
+
+		std::vector<char> data(COPY_SIZE, 1);
+		auto base = uhda_simple_stream_get_base(stream);
+		UhdaScatterChunk buffer;
+		uint32_t buffer_size;
+		if (uhda_stream_get_buffer(base, &buffer, &buffer_size) != UHDA_STATUS_SUCCESS) {
+			buffer_size = 0;
+		}
+
+		bool ok = buffer_size != 0 && uhda_simple_stream_play(stream, true) == UHDA_STATUS_SUCCESS;
+		for (uint32_t i = 0; ok && i < COPY_ROUNDS; ++i) {
+			uint32_t size = COPY_SIZE;
+			uhda_simple_stream_queue_data(stream, data.data(), &size);
+
+			*base->dma_pos = (*base->dma_pos + COPY_SIZE) % buffer_size;
+			auto start = Clock::now();
+			base->period_callback(base, base->period_callback_arg);
+			auto end = Clock::now();
+			timing.add(to_us(end - start));
+		}
+
+		uhda_simple_stream_destroy(stream);
+		return ok;
+	}
+}
+
+int main(int argc, char** argv) {
+	uint32_t iterations = 100;
+	bool skip_delays = false;
+	std::vector<CodecDump> dumps;
+
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			iterations = strtoul(argv[++i], nullptr, 10);
+			if (!iterations) {
+				iterations = 1;
+			}
+		}
+		else if (strcmp(argv[i], "--no-delays") == 0) {
+			skip_delays = true;
+		}
+		else {
+			CodecDump dump;
+			std::string error;
+			if (!load_codec_dump(argv[i], dump, error)) {
+				fprintf(stderr, "%s: %s\n", argv[i], error.c_str());
+				return 1;
+			}
+			dumps.push_back(std::move(dump));
+		}
+	}
+
+	if (dumps.empty() || dumps.size() > 15) {
+		fprintf(stderr, "usage: %s [-n iterations] [--no-delays] dump...\n", argv[0]);
+		return 1;
+	}
+
+	for (size_t i = 0; i < dumps.size(); ++i) {
+		auto& dump = dumps[i];
+		printf("codec %zu: %s (vendor 0x%08x, %zu nodes)\n",
+			i, dump.name.c_str(), dump.vendor_id, dump.nodes.size());
+	}
+
+	emulator_set_skip_delays(skip_delays);
+
+	Timing init_timing;
+	Timing path_timing;
+	Timing resume_timing;
+	Timing destroy_timing;
+	Timing ring_verb_timing;
+	Timing immediate_verb_timing;
+	Timing copy_timing;
+	size_t init_verbs = 0;
+	size_t init_doorbells = 0;
+	size_t init_mallocs = 0;
+	size_t init_malloc_bytes = 0;
+	size_t resume_verbs = 0;
+	size_t resume_doorbells = 0;
+	size_t presence_verbs = 0;
+	size_t presence_doorbells = 0;
+
+	for (uint32_t iter = 0; iter < iterations; ++iter) {
+		emulator_start(dumps.data(), dumps.size());
+		emulator_reset_stats();
+
+		UhdaController* controller;
+		auto start = Clock::now();
+		auto status = uhda_init(emulator_pci_device(), &controller);
+		auto end = Clock::now();
+		if (status != UHDA_STATUS_SUCCESS) {
+			fprintf(stderr, "uhda_init failed with status %d\n", status);
+			emulator_stop();
+			return 1;
+		}
+		init_timing.add(to_us(end - start));
+
+		auto stats = emulator_get_stats();
+		init_verbs = stats.verbs;
+		init_doorbells = stats.doorbells;
+		init_mallocs = stats.mallocs;
+		init_malloc_bytes = stats.malloc_bytes;
+
+		if (iter == 0) {
+			if (controller->codecs.size() != dumps.size()) {
+				fprintf(stderr, "warning: only %zu of %zu codecs were enumerated\n",
+					controller->codecs.size(), dumps.size());
+			}
+
+			for (auto codec : controller->codecs) {
+				const UhdaOutputGroup* const* groups;
+				size_t group_count;
+				uhda_codec_get_output_groups(codec, &groups, &group_count);
+
+				size_t output_count = 0;
+				for (size_t i = 0; i < group_count; ++i) {
+					const UhdaOutput* const* outputs;
+					size_t count;
+					uhda_output_group_get_outputs(groups[i], &outputs, &count);
+					output_count += count;
+				}
+
+				printf("codec %u: %zu output paths, %zu output groups, %zu outputs\n",
+					codec->cid, codec->output_paths.size(), group_count, output_count);
+			}
+		}
+
+		// re-run only the path search on the already enumerated graph
+		for (auto codec : controller->codecs) {
+			if (!codec->output_paths.resize(0)) {
+				return 1;
+			}
+			start = Clock::now();
+			status = codec->find_output_paths();
+			end = Clock::now();
+			if (status != UHDA_STATUS_SUCCESS) {
+				fprintf(stderr, "find_output_paths failed with status %d\n", status);
+				return 1;
+			}
+			path_timing.add(to_us(end - start));
+		}
+
+		if (!controller->codecs.is_empty()) {
+			if (!time_verbs(controller, UHDA_VERB_TRANSPORT_RINGS, ring_verb_timing) ||
+				!time_verbs(controller, UHDA_VERB_TRANSPORT_IMMEDIATE, immediate_verb_timing)) {
+				fprintf(stderr, "timing verbs failed\n");
+				return 1;
+			}
+		}
+
+		if (!controller->codecs.is_empty()) {
+			// the pin sense verbs of all outputs should be submitted with a single doorbell
+			bool presence[64];
+			size_t presence_count = sizeof(presence) / sizeof(*presence);
+			emulator_reset_stats();
+			if (uhda_codec_get_presence(controller->codecs[0], presence, &presence_count) != UHDA_STATUS_SUCCESS) {
+				fprintf(stderr, "querying the presence failed\n");
+				return 1;
+			}
+			stats = emulator_get_stats();
+			presence_verbs = stats.verbs;
+			presence_doorbells = stats.doorbells;
+		}
+
+		if (!time_copy(controller, copy_timing)) {
+			fprintf(stderr, "timing the simple stream copy failed\n");
+			return 1;
+		}
+
+		// re-enumerate the codecs like after a system resume
+		status = uhda_suspend(controller);
+		if (status != UHDA_STATUS_SUCCESS) {
+			fprintf(stderr, "uhda_suspend failed with status %d\n", status);
+			return 1;
+		}
+		emulator_reset_stats();
+		start = Clock::now();
+		status = uhda_resume(controller);
+		end = Clock::now();
+		if (status != UHDA_STATUS_SUCCESS) {
+			fprintf(stderr, "uhda_resume failed with status %d\n", status);
+			return 1;
+		}
+		resume_timing.add(to_us(end - start));
+		stats = emulator_get_stats();
+		resume_verbs = stats.verbs;
+		resume_doorbells = stats.doorbells;
+
+		start = Clock::now();
+		uhda_destroy(controller);
+		end = Clock::now();
+		destroy_timing.add(to_us(end - start));
+
+		emulator_stop();
+	}
+
+	printf("\n%u iterations%s\n", iterations, skip_delays ? " (delays skipped)" : "");
+	print_timing("uhda_init", init_timing, iterations);
+	print_timing("find_output_paths", path_timing, iterations * dumps.size());
+	print_timing("uhda_resume", resume_timing, iterations);
+	print_timing("uhda_destroy", destroy_timing, iterations);
+	print_timing("verb (rings)", ring_verb_timing, iterations * LATENCY_VERBS);
+	print_timing("verb (immediate)", immediate_verb_timing, iterations * LATENCY_VERBS);
+	print_timing("simple copy (64k)", copy_timing, iterations * COPY_ROUNDS);
+	printf("verbs per init: %zu (%zu doorbells)\n", init_verbs, init_doorbells);
+	printf("verbs per resume: %zu (%zu doorbells)\n", resume_verbs, resume_doorbells);
+	printf("verbs per presence query: %zu (%zu doorbells)\n", presence_verbs, presence_doorbells);
+	printf("allocations per init: %zu (%zu bytes)\n", init_mallocs, init_malloc_bytes);
+
+	return 0;
+}
@@ -0,0 +1,351 @@
+#include "dump.hpp"
+#include "spec.hpp"
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace uhda;
+
+namespace {
+	enum {
+		PARAM_VENDOR_ID = 0x0,
+		PARAM_REVISION_ID = 0x2,
+		PARAM_STREAM_FORMATS = 0xB
+	};
+
+	bool starts_with(const char* str, const char* prefix) {
+		return strncmp(str, prefix, strlen(prefix)) == 0;
+	}
+
+	uint32_t parse_hex_after(const char* str, const char* marker) {
+		auto* pos = strstr(str, marker);
+		if (!pos) {
+			return 0;
+		}
+		return static_cast<uint32_t>(strtoul(pos + strlen(marker), nullptr, 16));
+	}
+
+	// "ofs=0x40, nsteps=0x40, stepsize=0x03, mute=0" or "N/A"
+	uint32_t parse_amp_caps(const char* str) {
+		if (strstr(str, "N/A")) {
+			return 0;
+		}
+
+		uint32_t ofs = parse_hex_after(str, "ofs=");
+		uint32_t nsteps = parse_hex_after(str, "nsteps=");
+		uint32_t step_size = parse_hex_after(str, "stepsize=");
+		uint32_t mute = parse_hex_after(str, "mute=");
+		return (ofs & 0x7F) | (nsteps & 0x7F) << 8 | (step_size & 0x7F) << 16 | (mute ? 1U << 31 : 0);
+	}
+
+	// "rates [0x560]: 44100 48000" -> 0x560
+	uint32_t parse_bracket_hex(const char* str) {
+		auto* pos = strchr(str, '[');
+		if (!pos) {
+			return 0;
+		}
+		return static_cast<uint32_t>(strtoul(pos + 1, nullptr, 16));
+	}
+}
+
+const DumpNode* CodecDump::find_node(uint8_t nid) const {
+	auto iter = std::lower_bound(nodes.begin(), nodes.end(), nid, [](const DumpNode& node, uint8_t value) {
+		return node.nid < value;
+	});
+	if (iter == nodes.end() || iter->nid != nid) {
+		return nullptr;
+	}
+	return &*iter;
+}
+
+uint32_t CodecDump::respond(uint8_t nid, uint32_t payload) const {
+	uint16_t verb;
+	uint16_t data;
+	uint8_t verb_type = payload >> 16 & 0xF;
+	if (verb_type == 0x7 || verb_type == 0xF) {
+		verb = payload >> 8;
+		data = payload & 0xFF;
+	}
+	else {
+		verb = verb_type;
+		data = payload & 0xFFFF;
+	}
+
+	if (verb != cmd::GET_PARAM &&
+		verb != cmd::GET_CONN_LIST &&
+		verb != cmd::GET_CONFIG_DEFAULT &&
+		verb != cmd::GET_PIN_SENSE) {
+		// set verbs and state reads that aren't part of the dump
+		return 0;
+	}
+
+	if (nid == 0) {
+		if (verb != cmd::GET_PARAM) {
+			return 0;
+		}
+
+		switch (data) {
+			case PARAM_VENDOR_ID:
+				return vendor_id;
+			case PARAM_REVISION_ID:
+				return revision_id;
+			case param::NODE_COUNT:
+				return afg_nid << 16 | 1;
+			default:
+				return 0;
+		}
+	}
+
+	if (nid == afg_nid) {
+		if (verb != cmd::GET_PARAM) {
+			return 0;
+		}
+
+		switch (data) {
+			case param::NODE_COUNT:
+			{
+				if (nodes.empty()) {
+					return 0;
+				}
+				uint32_t first = nodes.front().nid;
+				uint32_t count = nodes.back().nid - first + 1;
+				return first << 16 | count;
+			}
+			case param::FUNC_GROUP_TYPE:
+				return func_group_type::AUDIO | (afg_unsol ? 1 << 8 : 0);
+			case param::SUPPORTED_RATES:
+				return default_rates;
+			case PARAM_STREAM_FORMATS:
+				return default_formats;
+			case param::IN_AMP_CAPS:
+				return default_in_amp_caps;
+			case param::OUT_AMP_CAPS:
+				return default_out_amp_caps;
+			default:
+				return 0;
+		}
+	}
+
+	auto* node = find_node(nid);
+	if (!node) {
+		return 0;
+	}
+
+	if (verb == cmd::GET_CONFIG_DEFAULT) {
+		return node->default_config;
+	}
+	else if (verb == cmd::GET_PIN_SENSE) {
+		// the dump doesn't record jack state, report connected jacks as present
+		bool jack = (node->default_config >> 30) == 0;
+		return jack ? 1U << 31 : 0;
+	}
+	else if (verb == cmd::GET_CONN_LIST) {
+		uint32_t res = 0;
+		for (uint32_t i = 0; i < 4; ++i) {
+			if (data + i >= node->connections.size()) {
+				break;
+			}
+			res |= static_cast<uint32_t>(node->connections[data + i]) << (i * 8);
+		}
+		return res;
+	}
+
+	switch (data) {
+		case param::AUDIO_CAPS:
+			return node->wcaps;
+		case param::SUPPORTED_RATES:
+			return node->has_pcm ? node->pcm_rates : 0;
+		case PARAM_STREAM_FORMATS:
+			return node->has_pcm ? node->pcm_formats : 0;
+		case param::PIN_CAPS:
+			return node->pin_caps;
+		case param::IN_AMP_CAPS:
+			return node->in_amp_caps;
+		case param::OUT_AMP_CAPS:
+			return node->out_amp_caps;
+		case param::CONN_LIST_LEN:
+			return node->connections.size() & 0x7F;
+		default:
+			return 0;
+	}
+}
+
+bool parse_codec_dump(const std::string& text, CodecDump& res, std::string& error) {
+	res = {};
+
+	DumpNode* node = nullptr;
+	// where "rates"/"bits"/"formats" lines go, either the afg defaults or a node
+	uint32_t* cur_rates = nullptr;
+	uint32_t* cur_formats = nullptr;
+	uint32_t pending_connections = 0;
+	bool seen_codec = false;
+
+	size_t line_start = 0;
+	uint32_t line_num = 0;
+	while (line_start < text.size()) {
+		size_t line_end = text.find('\n', line_start);
+		if (line_end == std::string::npos) {
+			line_end = text.size();
+		}
+		std::string line_storage = text.substr(line_start, line_end - line_start);
+		line_start = line_end + 1;
+		++line_num;
+
+		const char* line = line_storage.c_str();
+		while (*line == ' ' || *line == '\t') {
+			++line;
+		}
+
+		if (pending_connections) {
+			const char* ptr = line;
+			while (pending_connections && *ptr) {
+				char* end;
+				auto value = strtoul(ptr, &end, 16);
+				if (end == ptr) {
+					break;
+				}
+				node->connections.push_back(static_cast<uint8_t>(value));
+				--pending_connections;
+
+				ptr = end;
+				// the currently selected connection is marked with an asterisk
+				while (*ptr == '*' || *ptr == ' ') {
+					++ptr;
+				}
+			}
+
+			if (pending_connections && ptr == line) {
+				error = "line " + std::to_string(line_num) + ": truncated connection list";
+				return false;
+			}
+			continue;
+		}
+
+		if (starts_with(line, "Codec:")) {
+			if (seen_codec) {
+				error = "line " + std::to_string(line_num) + ": more than one codec in the dump";
+				return false;
+			}
+			seen_codec = true;
+			res.name = line + 6;
+			while (!res.name.empty() && res.name.front() == ' ') {
+				res.name.erase(res.name.begin());
+			}
+		}
+		else if (starts_with(line, "AFG Function Id:")) {
+			res.afg_unsol = strstr(line, "unsol 1");
+		}
+		else if (starts_with(line, "Vendor Id:")) {
+			res.vendor_id = strtoul(line + 10, nullptr, 16);
+		}
+		else if (starts_with(line, "Subsystem Id:")) {
+			res.subsystem_id = strtoul(line + 13, nullptr, 16);
+		}
+		else if (starts_with(line, "Revision Id:")) {
+			res.revision_id = strtoul(line + 12, nullptr, 16);
+		}
+		else if (starts_with(line, "State of AFG node")) {
+			res.afg_nid = strtoul(line + 17, nullptr, 16);
+		}
+		else if (starts_with(line, "Default PCM:")) {
+			cur_rates = &res.default_rates;
+			cur_formats = &res.default_formats;
+		}
+		else if (starts_with(line, "Default Amp-In caps:")) {
+			res.default_in_amp_caps = parse_amp_caps(line + 20);
+		}
+		else if (starts_with(line, "Default Amp-Out caps:")) {
+			res.default_out_amp_caps = parse_amp_caps(line + 21);
+		}
+		else if (starts_with(line, "Node ")) {
+			// Node 0x02 [Audio Output] wcaps 0x41d: Stereo Amp-Out
+			auto nid = strtoul(line + 5, nullptr, 16);
+			if (nid == 0 || nid > 0x7F) {
+				error = "line " + std::to_string(line_num) + ": invalid node id";
+				return false;
+			}
+			if (!res.nodes.empty() && res.nodes.back().nid >= nid) {
+				error = "line " + std::to_string(line_num) + ": nodes are not in ascending order";
+				return false;
+			}
+
+			res.nodes.push_back({});
+			node = &res.nodes.back();
+			node->nid = static_cast<uint8_t>(nid);
+			node->wcaps = parse_hex_after(line, "wcaps ");
+			cur_rates = nullptr;
+			cur_formats = nullptr;
+		}
+		else if (!node) {
+			continue;
+		}
+		else if (starts_with(line, "Amp-In caps:")) {
+			node->in_amp_caps = parse_amp_caps(line + 12);
+		}
+		else if (starts_with(line, "Amp-Out caps:")) {
+			node->out_amp_caps = parse_amp_caps(line + 13);
+		}
+		else if (starts_with(line, "Pincap ")) {
+			node->pin_caps = strtoul(line + 7, nullptr, 16);
+		}
+		else if (starts_with(line, "Pin Default ")) {
+			node->default_config = strtoul(line + 12, nullptr, 16);
+		}
+		else if (starts_with(line, "PCM:")) {
+			node->has_pcm = true;
+			cur_rates = &node->pcm_rates;
+			cur_formats = &node->pcm_formats;
+		}
+		else if (starts_with(line, "Connection:")) {
+			pending_connections = strtoul(line + 11, nullptr, 10);
+			if (pending_connections > 0x7F) {
+				error = "line " + std::to_string(line_num) + ": long-form connection lists are not supported";
+				return false;
+			}
+		}
+
+		if (cur_rates && starts_with(line, "rates [")) {
+			*cur_rates = (*cur_rates & 0xFFFF0000) | (parse_bracket_hex(line) & 0xFFFF);
+		}
+		else if (cur_rates && starts_with(line, "bits [")) {
+			*cur_rates = (*cur_rates & 0xFFFF) | (parse_bracket_hex(line) & 0xFFFF) << 16;
+		}
+		else if (cur_formats && starts_with(line, "formats [")) {
+			*cur_formats = parse_bracket_hex(line);
+		}
+	}
+
+	if (pending_connections) {
+		error = "unexpected end of dump inside a connection list";
+		return false;
+	}
+	if (!seen_codec) {
+		error = "no codec found in the dump";
+		return false;
+	}
+	if (res.nodes.empty()) {
+		error = "no nodes found in the dump";
+		return false;
+	}
+
+	return true;
+}
+
+bool load_codec_dump(const char* path, CodecDump& res, std::string& error) {
+	auto* file = fopen(path, "rb");
+	if (!file) {
+		error = std::string {"failed to open "} + path;
+		return false;
+	}
+
+	std::string text;
+	char buf[4096];
+	size_t read;
+	while ((read = fread(buf, 1, sizeof(buf), file)) != 0) {
+		text.append(buf, read);
+	}
+	fclose(file);
+
+	return parse_codec_dump(text, res, error);
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*
+ * A codec graph parsed from Linux codec dump text (/proc/asound/cardN/codec#M).
+ */
+
+struct DumpNode {
+	uint8_t nid;
+	uint32_t wcaps;
+	uint32_t in_amp_caps;
+	uint32_t out_amp_caps;
+	uint32_t pin_caps;
+	uint32_t default_config;
+	uint32_t pcm_rates;
+	uint32_t pcm_formats;
+	bool has_pcm;
+	std::vector<uint8_t> connections;
+};
+
+struct CodecDump {
+	std::string name;
+	uint32_t vendor_id {};
+	uint32_t subsystem_id {};
+	uint32_t revision_id {};
+	uint8_t afg_nid {1};
+	bool afg_unsol {};
+	uint32_t default_rates {};
+	uint32_t default_formats {};
+	uint32_t default_in_amp_caps {};
+	uint32_t default_out_amp_caps {};
+	std::vector<DumpNode> nodes;
+
+	[[nodiscard]] const DumpNode* find_node(uint8_t nid) const;
+
+	/*
+	 * Answers a verb sent to the codec the way the dumped hardware would.
+	 * `payload` is the 20-bit verb payload (command and data).
+	 */
+	[[nodiscard]] uint32_t respond(uint8_t nid, uint32_t payload) const;
+};
+
+bool parse_codec_dump(const std::string& text, CodecDump& res, std::string& error);
+bool load_codec_dump(const char* path, CodecDump& res, std::string& error);
@@ -0,0 +1,463 @@
+#include "emulator.hpp"
+#include "spec.hpp"
+#include "uhda/kernel_api.h"
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <thread>
+#include <ucontext.h>
+
+using namespace uhda;
+
+namespace {
+	constexpr size_t BAR_SIZE = 0x4000;
+	constexpr uint8_t IN_STREAMS = 4;
+	constexpr uint8_t OUT_STREAMS = 4;
+	constexpr uint64_t TRAP_FLAG = 1 << 8;
+
+	struct Emulator {
+		uint8_t* regs;
+		const CodecDump* codecs;
+		size_t codec_count;
+		uint16_t pci_cmd;
+		UhdaIrqHandlerFn irq_fn;
+		void* irq_arg;
+		bool irq_enabled;
+		uint8_t corb_rp;
+		uint8_t rirb_wp;
+		// -1 if the presence from the dump is used
+		int8_t presence[16][256];
+		// 0 if unsolicited responses are disabled, otherwise the tag with the enable bit
+		uint8_t unsol[16][256];
+	};
+
+	Emulator EMU {};
+	bool SKIP_DELAYS = false;
+
+	size_t VERB_COUNT;
+	size_t DOORBELL_COUNT;
+	std::atomic<size_t> MALLOC_COUNT;
+	std::atomic<size_t> MALLOC_BYTES;
+	std::atomic<size_t> LIVE_MALLOCS;
+
+	MemSpace emu_space() {
+		return MemSpace {reinterpret_cast<uintptr_t>(EMU.regs)};
+	}
+
+	uint64_t load_base(MemSpace space, BasicRegister<uint32_t> low, BasicRegister<uint32_t> high) {
+		return space.load(low) | static_cast<uint64_t>(space.load(high)) << 32;
+	}
+
+	uint32_t respond(uint8_t cid, uint8_t nid, uint32_t payload) {
+		uint16_t cmd = payload >> 8;
+		if (cmd == cmd::SET_UNSOL_ENABLE) {
+			EMU.unsol[cid][nid] = payload & 0xFF;
+			return 0;
+		}
+		else if (cmd == cmd::GET_PIN_SENSE && EMU.presence[cid][nid] >= 0) {
+			return EMU.presence[cid][nid] ? 1U << 31 : 0;
+		}
+		return EMU.codecs[cid].respond(nid, payload);
+	}
+
+	void process_corb() {
+		auto space = emu_space();
+		if (!(space.load(regs::CORBCTL) & corbctl::RUN) || !(space.load(regs::RIRBCTL) & rirbctl::DMAEN)) {
+			return;
+		}
+
+		uint8_t wp = space.load(regs::CORBWP) & corbwp::WP;
+		if (wp == EMU.corb_rp) {
+			return;
+		}
+
+		++DOORBELL_COUNT;
+		auto* corb = reinterpret_cast<volatile uint32_t*>(load_base(space, regs::CORBLBASE, regs::CORBUBASE));
+		auto* rirb = reinterpret_cast<volatile ResponseDescriptor*>(load_base(space, regs::RIRBLBASE, regs::RIRBUBASE));
+
+		while (EMU.corb_rp != wp) {
+			uint8_t index = EMU.corb_rp + 1;
+			uint32_t verb = corb[index];
+
+			uint8_t cid = verb >> 28;
+			uint8_t nid = verb >> 20 & 0xFF;
+			uint32_t payload = verb & 0xFFFFF;
+
+			uint32_t resp = 0;
+			if (cid < EMU.codec_count) {
+				resp = respond(cid, nid, payload);
+			}
+
+			uint8_t rirb_index = ++EMU.rirb_wp;
+			rirb[rirb_index].resp = resp;
+			rirb[rirb_index].resp_ex = cid;
+
+			EMU.corb_rp = index;
+			space.store(regs::CORBRP, index);
+			space.store(regs::RIRBWP, rirb_index);
+			++VERB_COUNT;
+		}
+	}
+
+	void process_immediate() {
+		auto space = emu_space();
+		if (!(space.load(regs::ICIS) & icis::ICB)) {
+			return;
+		}
+
+		uint32_t verb = space.load(regs::ICOI);
+		uint8_t cid = verb >> 28;
+		uint8_t nid = verb >> 20 & 0xFF;
+
+		uint32_t resp = 0;
+		if (cid < EMU.codec_count) {
+			resp = respond(cid, nid, verb & 0xFFFFF);
+		}
+
+		space.store(regs::ICII, resp);
+		space.store(regs::ICIS, icis::IRV(true));
+		++VERB_COUNT;
+	}
+
+	void process_reset() {
+		auto space = emu_space();
+		if (space.load(regs::GCTL) & gctl::CRST) {
+			return;
+		}
+
+		// the ring buffer pointers and the controller state are reset while in reset
+		EMU.corb_rp = 0;
+		EMU.rirb_wp = 0;
+		space.store(regs::GCTL, 0);
+		space.store(regs::CORBWP, 0);
+		space.store(regs::CORBRP, 0);
+		space.store(regs::RIRBWP, 0);
+		space.store(regs::INTCTL, 0);
+		space.store(regs::ICIS, 0);
+	}
+
+	/*
+	 * Register accesses are trapped by keeping the bar protected.
+	 * The faulting access is single-stepped with the bar accessible,
+	 * after which the controller reacts to it and the bar is protected again.
+	 */
+
+	void protect_bar(bool protect) {
+		mprotect(EMU.regs, BAR_SIZE, protect ? PROT_NONE : PROT_READ | PROT_WRITE);
+	}
+
+	void segv_handler(int, siginfo_t* info, void* ctx) {
+		auto addr = reinterpret_cast<uintptr_t>(info->si_addr);
+		auto base = reinterpret_cast<uintptr_t>(EMU.regs);
+		if (!EMU.regs || addr < base || addr >= base + BAR_SIZE) {
+			signal(SIGSEGV, SIG_DFL);
+			return;
+		}
+
+		protect_bar(false);
+		static_cast<ucontext_t*>(ctx)->uc_mcontext.gregs[REG_EFL] |= TRAP_FLAG;
+	}
+
+	void trap_handler(int, siginfo_t*, void* ctx) {
+		static_cast<ucontext_t*>(ctx)->uc_mcontext.gregs[REG_EFL] &= ~TRAP_FLAG;
+		process_reset();
+		process_corb();
+		process_immediate();
+		protect_bar(true);
+	}
+
+	void install_handlers() {
+		static bool installed = false;
+		if (installed) {
+			return;
+		}
+		installed = true;
+
+		struct sigaction action {};
+		action.sa_sigaction = segv_handler;
+		action.sa_flags = SA_SIGINFO;
+		sigemptyset(&action.sa_mask);
+		sigaction(SIGSEGV, &action, nullptr);
+
+		action.sa_sigaction = trap_handler;
+		sigaction(SIGTRAP, &action, nullptr);
+	}
+}
+
+void emulator_start(const CodecDump* codecs, size_t codec_count) {
+	install_handlers();
+
+	if (!EMU.regs) {
+		EMU.regs = static_cast<uint8_t*>(
+			mmap(nullptr, BAR_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+		if (EMU.regs == MAP_FAILED) {
+			fprintf(stderr, "failed to map the emulated bar\n");
+			abort();
+		}
+	}
+	else {
+		protect_bar(false);
+	}
+
+	memset(EMU.regs, 0, BAR_SIZE);
+	EMU.codecs = codecs;
+	EMU.codec_count = codec_count;
+	EMU.pci_cmd = 0;
+	EMU.irq_fn = nullptr;
+	EMU.irq_arg = nullptr;
+	EMU.irq_enabled = false;
+	EMU.corb_rp = 0;
+	EMU.rirb_wp = 0;
+	memset(EMU.presence, -1, sizeof(EMU.presence));
+	memset(EMU.unsol, 0, sizeof(EMU.unsol));
+
+	auto space = emu_space();
+	space.store(regs::GCAP, gcap::OK64(true) | gcap::ISS(IN_STREAMS) | gcap::OSS(OUT_STREAMS));
+	// 256 entries supported
+	space.store(regs::CORBSIZE, corbsize::SZCAP(0b100));
+	space.store(regs::RIRBSIZE, rirbsize::SZCAP(0b100));
+	space.store(regs::STATESTS, static_cast<uint16_t>((1 << codec_count) - 1));
+
+	protect_bar(true);
+}
+
+void emulator_stop() {
+	protect_bar(false);
+}
+
+void emulator_set_presence(size_t codec, uint8_t nid, bool presence) {
+	EMU.presence[codec][nid] = presence;
+
+	uint8_t unsol = EMU.unsol[codec][nid];
+	protect_bar(false);
+	auto space = emu_space();
+	if (!(unsol & 1 << 7) || !(space.load(regs::GCTL) & gctl::UNSOL)) {
+		protect_bar(true);
+		return;
+	}
+
+	auto* rirb = reinterpret_cast<volatile ResponseDescriptor*>(load_base(space, regs::RIRBLBASE, regs::RIRBUBASE));
+	uint8_t index = ++EMU.rirb_wp;
+	rirb[index].resp = static_cast<uint32_t>(unsol & 0x3F) << 26;
+	rirb[index].resp_ex = codec | 1 << 4;
+	space.store(regs::RIRBWP, index);
+
+	bool raise = EMU.irq_fn && EMU.irq_enabled && (space.load(regs::RIRBCTL) & rirbctl::INTCTL);
+	if (raise) {
+		space.store(regs::RIRBSTS, rirbsts::INTFL(true));
+		space.store(regs::INTSTS, intsts::CIS(true) | intsts::GIS(true));
+	}
+	protect_bar(true);
+
+	if (raise) {
+		EMU.irq_fn(EMU.irq_arg);
+
+		protect_bar(false);
+		space.store(regs::INTSTS, 0);
+		protect_bar(true);
+	}
+}
+
+void emulator_set_skip_delays(bool skip) {
+	SKIP_DELAYS = skip;
+}
+
+void* emulator_pci_device() {
+	return &EMU;
+}
+
+EmulatorStats emulator_get_stats() {
+	return {
+		.verbs = VERB_COUNT,
+		.doorbells = DOORBELL_COUNT,
+		.mallocs = MALLOC_COUNT.load(),
+		.malloc_bytes = MALLOC_BYTES.load(),
+		.live_mallocs = LIVE_MALLOCS.load()
+	};
+}
+
+void emulator_reset_stats() {
+	VERB_COUNT = 0;
+	DOORBELL_COUNT = 0;
+	MALLOC_COUNT = 0;
+	MALLOC_BYTES = 0;
+}
+
+UhdaStatus uhda_kernel_pci_read(void*, uint8_t offset, uint8_t size, uint32_t* res) {
+	uint32_t value = 0;
+	if (offset == 0) {
+		// intel vendor, generic hda device
+		value = 0x8086 | 0x2668 << 16;
+	}
+	else if (offset == 4) {
+		value = EMU.pci_cmd;
+	}
+	else if (offset == 8) {
+		// class 4, subclass 3
+		value = 0x04030000;
+	}
+
+	if (size == 1) {
+		value &= 0xFF;
+	}
+	else if (size == 2) {
+		value &= 0xFFFF;
+	}
+	*res = value;
+	return UHDA_STATUS_SUCCESS;
+}
+
+UhdaStatus uhda_kernel_pci_write(void*, uint8_t offset, uint8_t, uint32_t value) {
+	if (offset == 4) {
+		EMU.pci_cmd = value;
+	}
+	return UHDA_STATUS_SUCCESS;
+}
+
+UhdaStatus uhda_kernel_pci_allocate_irq(
+	void*,
+	UhdaIrqHint,
+	UhdaIrqHandlerFn fn,
+	void* arg,
+	void** opaque_irq) {
+	EMU.irq_fn = fn;
+	EMU.irq_arg = arg;
+	*opaque_irq = &EMU;
+	return UHDA_STATUS_SUCCESS;
+}
+
+void uhda_kernel_pci_deallocate_irq(void*, void*) {
+	EMU.irq_fn = nullptr;
+	EMU.irq_arg = nullptr;
+}
+
+void uhda_kernel_pci_enable_irq(void*, void*, bool enable) {
+	EMU.irq_enabled = enable;
+}
+
+UhdaStatus uhda_kernel_pci_map_bar(void*, uint32_t bar, void** virt) {
+	if (bar != 0) {
+		return UHDA_STATUS_UNSUPPORTED;
+	}
+	*virt = EMU.regs;
+	return UHDA_STATUS_SUCCESS;
+}
+
+void uhda_kernel_pci_unmap_bar(void*, uint32_t, void*) {}
+
+void* uhda_kernel_malloc(size_t size) {
+	MALLOC_COUNT.fetch_add(1, std::memory_order_relaxed);
+	MALLOC_BYTES.fetch_add(size, std::memory_order_relaxed);
+	LIVE_MALLOCS.fetch_add(1, std::memory_order_relaxed);
+	return malloc(size);
+}
+
+void uhda_kernel_free(void* ptr, size_t) {
+	if (ptr) {
+		LIVE_MALLOCS.fetch_sub(1, std::memory_order_relaxed);
+	}
+	free(ptr);
+}
+
+void uhda_kernel_delay(uint32_t microseconds) {
+	if (SKIP_DELAYS) {
+		return;
+	}
+
+	auto end = std::chrono::steady_clock::now() + std::chrono::microseconds {microseconds};
+	while (std::chrono::steady_clock::now() < end);
+}
+
+void uhda_kernel_sleep(uint32_t microseconds) {
+	if (SKIP_DELAYS) {
+		return;
+	}
+
+	std::this_thread::sleep_for(std::chrono::microseconds {microseconds});
+}
+
+uint64_t uhda_kernel_get_nanoseconds() {
+	auto now = std::chrono::steady_clock::now().time_since_epoch();
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+void uhda_kernel_log(const char* str) {
+	fprintf(stderr, "uhda: %s\n", str);
+}
+
+UhdaStatus uhda_kernel_allocate_physical(size_t size, uintptr_t* res) {
+	void* ptr = aligned_alloc(0x1000, (size + 0xFFF) & ~0xFFF);
+	if (!ptr) {
+		return UHDA_STATUS_NO_MEMORY;
+	}
+	memset(ptr, 0, size);
+	// physical and virtual addresses are identical in the emulator
+	*res = reinterpret_cast<uintptr_t>(ptr);
+	return UHDA_STATUS_SUCCESS;
+}
+
+void uhda_kernel_deallocate_physical(uintptr_t phys, size_t) {
+	free(reinterpret_cast<void*>(phys));
+}
+
+UhdaStatus uhda_kernel_allocate_scatter(size_t count, size_t size, UhdaScatterChunk* res) {
+	for (size_t i = 0; i < count; ++i) {
+		uintptr_t phys;
+		auto status = uhda_kernel_allocate_physical(size, &phys);
+		if (status != UHDA_STATUS_SUCCESS) {
+			uhda_kernel_deallocate_scatter(res, i, size);
+			return status;
+		}
+		res[i].phys = phys;
+		res[i].virt = reinterpret_cast<void*>(phys);
+	}
+	return UHDA_STATUS_SUCCESS;
+}
+
+void uhda_kernel_deallocate_scatter(UhdaScatterChunk* chunks, size_t count, size_t size) {
+	for (size_t i = 0; i < count; ++i) {
+		uhda_kernel_deallocate_physical(chunks[i].phys, size);
+	}
+}
+
+UhdaStatus uhda_kernel_map(uintptr_t phys, size_t, void** virt) {
+	*virt = reinterpret_cast<void*>(phys);
+	return UHDA_STATUS_SUCCESS;
+}
+
+void uhda_kernel_unmap(void*, size_t) {}
+
+// host memory is always cached and coherent with the emulated controller
+UhdaStatus uhda_kernel_map_type(uintptr_t phys, size_t size, UhdaMapType, void** virt) {
+	return uhda_kernel_map(phys, size, virt);
+}
+
+void uhda_kernel_flush_cache(void*, size_t) {}
+
+UhdaStatus uhda_kernel_create_spinlock(void** spinlock) {
+	auto* lock = new (std::nothrow) std::atomic_flag {};
+	if (!lock) {
+		return UHDA_STATUS_NO_MEMORY;
+	}
+	*spinlock = lock;
+	return UHDA_STATUS_SUCCESS;
+}
+
+void uhda_kernel_free_spinlock(void* spinlock) {
+	delete static_cast<std::atomic_flag*>(spinlock);
+}
+
+UhdaIrqState uhda_kernel_lock_spinlock(void* spinlock) {
+	auto* lock = static_cast<std::atomic_flag*>(spinlock);
+	while (lock->test_and_set(std::memory_order_acquire));
+	return 0;
+}
+
+void uhda_kernel_unlock_spinlock(void* spinlock, UhdaIrqState) {
+	static_cast<std::atomic_flag*>(spinlock)->clear(std::memory_order_release);
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include "dump.hpp"
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A software HDA controller implementing the uHDA kernel API on a hosted system.
+ * Codecs loaded from dumps are attached at consecutive codec addresses and answer
+ * the verbs uHDA sends through the CORB from their dump.
+ *
+ * Note: register accesses are emulated by trapping them, which requires Linux on x86_64.
+ */
+
+struct EmulatorStats {
+	size_t verbs;
+	// corb write pointer updates that submitted new verbs
+	size_t doorbells;
+	size_t mallocs;
+	size_t malloc_bytes;
+	size_t live_mallocs;
+};
+
+/*
+ * Resets the emulated controller and attaches the codecs, must be called before `uhda_init`.
+ *
+ * Note: the codec dumps must stay valid until `emulator_stop` is called.
+ */
+void emulator_start(const CodecDump* codecs, size_t codec_count);
+
+/*
+ * Stops the emulated controller, must be called after `uhda_destroy`.
+ */
+void emulator_stop();
+
+/*
+ * Makes `uhda_kernel_delay` return immediately so only the enumeration cost is measured.
+ */
+void emulator_set_skip_delays(bool skip);
+
+/*
+ * Changes the presence reported by a pin, if unsolicited responses are enabled for the pin
+ * one is sent and the irq handler is called before returning.
+ */
+void emulator_set_presence(size_t codec, uint8_t nid, bool presence);
+
+/*
+ * Gets the pci device pointer to pass to `uhda_init`.
+ */
+void* emulator_pci_device();
+
+EmulatorStats emulator_get_stats();
+void emulator_reset_stats();
@@ -4,6 +4,7 @@ set(UHDA_SOURCES
 	"${CMAKE_CURRENT_LIST_DIR}/src/codec.cpp"
 	"${CMAKE_CURRENT_LIST_DIR}/src/stream.cpp"
 	"${CMAKE_CURRENT_LIST_DIR}/src/simple.cpp"
+	"${CMAKE_CURRENT_LIST_DIR}/src/dma_copy.cpp"
 )
 
 set(UHDA_INCLUDES